@@ -0,0 +1,293 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+#include <algorithm>
+
+#include <cstdint>
+#include <stdexcept>
+#include <utility>
+
+#include "rowBandScheduler.h"
+/*
+	CompactSpatialHashGrid
+
+	Same addAtom / clear / find interface as SpatialHashGrid, but instead of a
+	fixed 20 slot array per cell the atoms are stored in one dense id array that
+	is sorted by cell (compressed sparse row layout):
+
+	    m_cellStart[c] .. m_cellStart[c + 1]  ->  range of m_objects owned by cell c
+
+	addAtom() only records (cell, id) pairs, the table itself is rebuilt lazily on
+	the first find() after an insertion:
+	    1. count pass   - how many atoms land in each cell
+	    2. prefix sum   - turns the counts into cell start offsets
+	    3. scatter      - copies every id to its final slot
+
+	There is no per cell capacity, so no atoms are ever dropped, and a find()
+	reads 3 contiguous runs of ids instead of 9 mostly empty 84 byte cells.
+
+	buildParallel(scheduler) makes the same table on the workers of a RowBandScheduler,
+	call it after adding the atoms and the next find() uses the table it made.
+*/
+
+
+struct CompactSpatialHashGrid
+{
+	// csr table, rebuilt from the pending atoms by build()
+	std::vector<uint32_t> m_cellStart{};
+	std::vector<int32_t> m_objects{};
+
+	// atoms added since the last clear(), in insertion order
+	std::vector<uint32_t> m_atomCells{};
+	std::vector<int32_t> m_atomIds{};
+	bool m_built = true;
+
+	// buildParallel() scratch, one row of cell counts per part and the atom total of every part's block of cells
+	std::vector<uint32_t> m_threadCounts{};
+	std::vector<uint32_t> m_blockTotals{};
+
+	sf::Vector2u m_cellsXY{};
+	uint32_t m_cellCount = 0;
+
+	sf::Vector2f conversionFactor{};
+	std::vector<int32_t> found{};
+
+	sf::Vector2f m_cellDimensions{};
+	sf::Rect<float> m_screenSize{};
+
+	// constructor and destructor
+	explicit CompactSpatialHashGrid(const sf::Rect<float> screenSize = {}, const sf::Vector2u cellsXY = {})
+	{
+		init(screenSize, cellsXY);
+	}
+	~CompactSpatialHashGrid() = default;
+
+
+	void init(const sf::Rect<float> screenSize, const sf::Vector2u cellsXY)
+	{
+		m_cellsXY = cellsXY;
+		m_screenSize = screenSize;
+		m_cellCount = m_cellsXY.x * m_cellsXY.y;
+
+		m_cellStart.assign(static_cast<size_t>(m_cellCount) + 1, 0);
+
+		m_cellDimensions = { m_screenSize.width / static_cast<float>(m_cellsXY.x),
+							m_screenSize.height / static_cast<float>(m_cellsXY.y) };
+
+		conversionFactor = { 1.f / m_cellDimensions.x, 1.f / m_cellDimensions.y };
+
+		clear();
+	}
+
+
+	void reserve(const size_t atoms)
+	{
+		m_atomCells.reserve(atoms);
+		m_atomIds.reserve(atoms);
+		m_objects.reserve(atoms);
+	}
+
+
+	void addAtom(const sf::Vector2f pos, const int32_t atom)
+	{
+		if (!insideGrid(pos))
+			throw std::out_of_range("addAtom() position argument out of range");
+
+		m_atomCells.push_back(idx2dTo1d(posTo2dIdx(pos)));
+		m_atomIds.push_back(atom);
+		m_built = false;
+	}
+
+	void clear()
+	{
+		m_atomCells.clear();
+		m_atomIds.clear();
+		m_objects.clear();
+		m_built = false;
+	}
+
+	void build()
+	{
+		if (m_built)
+			return;
+
+		// count pass, shifted by one so the prefix sum produces start offsets in place
+		std::fill(m_cellStart.begin(), m_cellStart.end(), 0);
+		for (const uint32_t cell : m_atomCells)
+			m_cellStart[cell + 1]++;
+
+		// prefix sum
+		for (uint32_t c{0}; c < m_cellCount; c++)
+			m_cellStart[c + 1] += m_cellStart[c];
+
+		// scatter, m_cellStart[c] is used as the write cursor and ends up at the start of c + 1
+		m_objects.resize(m_atomIds.size());
+		for (size_t i{0}; i < m_atomIds.size(); i++)
+			m_objects[m_cellStart[m_atomCells[i]]++] = m_atomIds[i];
+
+		// undo the cursor shift
+		for (uint32_t c = m_cellCount; c > 0; c--)
+			m_cellStart[c] = m_cellStart[c - 1];
+		m_cellStart[0] = 0;
+
+		m_built = true;
+	}
+
+	// build() split into one part per worker of the scheduler. every part counts one contiguous slice of the atoms
+	// into its own row of m_threadCounts, the rows are turned into write offsets and every part scatters its own slice
+	// again. a part's atoms of a cell go right after the ones of the parts before it, so the table is exactly the one
+	// build() makes and nothing has to be atomic. the scheduler hands out the parts, so a part isn't tied to a thread
+	void buildParallel(RowBandScheduler& scheduler)
+	{
+		if (m_built)
+			return;
+
+		const uint32_t parts = scheduler.threads();
+		const auto atoms = static_cast<uint32_t>(m_atomIds.size());
+		if (parts <= 1 || atoms < parts)
+		{
+			build();
+			return;
+		}
+
+		// every part zeroes its own row in the count pass, so this only grows the buffer
+		const uint32_t cells = m_cellCount;
+		m_threadCounts.resize(static_cast<size_t>(parts) * cells);
+		m_blockTotals.assign(static_cast<size_t>(parts) + 1, 0);
+
+		// [begin, end) of part t when count things are split in parts
+		const auto slice = [parts](const uint32_t count, const uint32_t t)
+		{
+			return std::pair<uint32_t, uint32_t>{
+				static_cast<uint32_t>(static_cast<uint64_t>(count) * t / parts),
+				static_cast<uint32_t>(static_cast<uint64_t>(count) * (t + 1) / parts) };
+		};
+
+		// runs func(t) for every part, the "rows" the scheduler hands out are the parts
+		const auto forEachPart = [&](auto&& func)
+		{
+			scheduler.run(parts, [&func](const uint32_t partBegin, const uint32_t partEnd, uint32_t)
+			{
+				for (uint32_t t = partBegin; t < partEnd; t++)
+					func(t);
+			});
+		};
+
+		// count pass
+		forEachPart([&](const uint32_t t)
+		{
+			uint32_t* counts = m_threadCounts.data() + static_cast<size_t>(t) * cells;
+			std::fill_n(counts, cells, 0);
+
+			const auto [begin, end] = slice(atoms, t);
+			for (uint32_t i = begin; i < end; i++)
+				counts[m_atomCells[i]]++;
+		});
+
+		// prefix sum, every part adds up a block of cells, the block totals are summed up in order and then every
+		// part hands out the offsets inside its block, per cell in part order
+		forEachPart([&](const uint32_t t)
+		{
+			uint32_t total = 0;
+			const auto [begin, end] = slice(cells, t);
+			for (uint32_t c = begin; c < end; c++)
+			{
+				for (uint32_t u{0}; u < parts; u++)
+					total += m_threadCounts[static_cast<size_t>(u) * cells + c];
+			}
+			m_blockTotals[t + 1] = total;
+		});
+
+		for (uint32_t t{0}; t < parts; t++)
+			m_blockTotals[t + 1] += m_blockTotals[t];
+
+		forEachPart([&](const uint32_t t)
+		{
+			uint32_t offset = m_blockTotals[t];
+			const auto [begin, end] = slice(cells, t);
+			for (uint32_t c = begin; c < end; c++)
+			{
+				m_cellStart[c] = offset;
+				for (uint32_t u{0}; u < parts; u++)
+				{
+					uint32_t& count = m_threadCounts[static_cast<size_t>(u) * cells + c];
+					const uint32_t atomsInCell = count;
+					count = offset;
+					offset += atomsInCell;
+				}
+			}
+		});
+		m_cellStart[cells] = atoms;
+
+		// scatter, the offsets are used as write cursors
+		m_objects.resize(atoms);
+		forEachPart([&](const uint32_t t)
+		{
+			uint32_t* cursors = m_threadCounts.data() + static_cast<size_t>(t) * cells;
+			const auto [begin, end] = slice(atoms, t);
+			for (uint32_t i = begin; i < end; i++)
+				m_objects[cursors[m_atomCells[i]]++] = m_atomIds[i];
+		});
+
+		m_built = true;
+	}
+
+	std::vector<int32_t>& find(const sf::Vector2f position)
+	{
+		build();
+		found.clear();
+
+		if (!insideGrid(position))
+			throw std::out_of_range("find() position argument out of range");
+
+		const sf::Vector2<uint32_t> cIdx = posTo2dIdx(position);
+
+		const uint32_t minX = cIdx.x > 0 ? cIdx.x - 1 : 0;
+		const uint32_t maxX = std::min(cIdx.x + 1, m_cellsXY.x - 1);
+		const uint32_t minY = cIdx.y > 0 ? cIdx.y - 1 : 0;
+		const uint32_t maxY = std::min(cIdx.y + 1, m_cellsXY.y - 1);
+
+		// cells on the same row are next to each other, so each row is one contiguous run of ids
+		for (uint32_t y = minY; y <= maxY; y++)
+		{
+			const uint32_t begin = m_cellStart[idx2dTo1d({ minX, y })];
+			const uint32_t end = m_cellStart[idx2dTo1d({ maxX, y }) + 1];
+
+			found.insert(found.end(), m_objects.begin() + begin, m_objects.begin() + end);
+		}
+
+		return found;
+	}
+
+	[[nodiscard]] uint32_t cellSize(const uint32_t cell) const
+	{
+		return m_cellStart[cell + 1] - m_cellStart[cell];
+	}
+
+	[[nodiscard]] uint32_t idx2dTo1d(const sf::Vector2<uint32_t> idx) const
+	{
+		return idx.x + idx.y * m_cellsXY.x;
+	}
+
+	[[nodiscard]] sf::Vector2<uint32_t> posTo2dIdx(const sf::Vector2f position) const
+	{
+		return {
+			static_cast<uint32_t>(position.x * conversionFactor.x),
+			static_cast<uint32_t>(position.y * conversionFactor.y)};
+	}
+
+	// checked on the float position, casting a negative one to uint32_t is undefined
+	[[nodiscard]] bool insideGrid(const sf::Vector2f position) const
+	{
+		const float x = position.x * conversionFactor.x;
+		const float y = position.y * conversionFactor.y;
+		return x >= 0.f && y >= 0.f && x < static_cast<float>(m_cellsXY.x) && y < static_cast<float>(m_cellsXY.y);
+	}
+
+
+	void reSize(const sf::Rect<float> screenSize)
+	{
+		init(screenSize, m_cellsXY);
+	}
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+
+#include "spatialHashGrid.h"
+/*
+	HashedSpatialHashGrid
+
+	Unbounded version of SpatialHashGrid. Positions are turned into integer cell
+	coordinates, which are hashed into an open addressed (linear probing) table.
+	Only cells that actually hold atoms exist, so memory scales with the number of
+	atoms instead of the size of the world, and any position is valid, negative
+	ones included.
+
+	The table is kept at most half full and doubles when it gets past that. It keeps
+	its capacity between frames, clear() only resets the slots that were used.
+*/
+
+
+template<typename IdType = int32_t, uint16_t CellCapacity = 20, typename CountType = uint8_t>
+struct BasicHashedSpatialHashGrid
+{
+	using Cell = CollisionCell<IdType, CellCapacity, CountType>;
+	using Pool = typename Cell::Pool;
+	using Result = c_Vec<IdType, CellCapacity * 9>;
+
+	struct Slot
+	{
+		sf::Vector2i coords{};
+		uint32_t cell = Pool::none;
+	};
+
+	std::vector<Slot> m_table{};
+	std::vector<uint32_t> m_usedSlots{};
+	uint32_t m_mask = 0;
+
+	// one cell per occupied table slot, in order of first use
+	std::vector<Cell> m_cells{};
+	uint32_t m_cellCount = 0;
+	Pool m_overflow{};
+
+	float m_cellSize{};
+	float conversionFactor{};
+	Result found{};
+
+	// constructor and destructor
+	explicit BasicHashedSpatialHashGrid(const float cellSize = 1.f, const uint32_t expectedCells = 64)
+	{
+		init(cellSize, expectedCells);
+	}
+	~BasicHashedSpatialHashGrid() = default;
+
+
+	void init(const float cellSize, const uint32_t expectedCells)
+	{
+		m_cellSize = cellSize;
+		conversionFactor = 1.f / m_cellSize;
+
+		uint32_t capacity = 16;
+		while (capacity < expectedCells * 2)
+			capacity *= 2;
+
+		m_table.assign(capacity, Slot{});
+		m_mask = capacity - 1;
+		m_usedSlots.clear();
+		m_cellCount = 0;
+		m_overflow.clear();
+	}
+
+
+	// other functions
+	void addAtom(const sf::Vector2f pos, const IdType atom)
+	{
+		m_cells[findOrInsertCell(posToCell(pos))].addAtom(atom, m_overflow);
+	}
+
+	void clear()
+	{
+		for (const uint32_t slot : m_usedSlots)
+			m_table[slot].cell = Pool::none;
+
+		m_usedSlots.clear();
+		m_cellCount = 0;
+		m_overflow.clear();
+	}
+
+	Result& find(const sf::Vector2f position)
+	{
+		found.size = 0;
+
+		const sf::Vector2i cIdx = posToCell(position);
+
+		for (int x = cIdx.x - 1; x <= cIdx.x + 1; x++)
+		{
+			for (int y = cIdx.y - 1; y <= cIdx.y + 1; y++)
+			{
+				if (const Cell* cell = getCell({ x, y }))
+					cell->forEach(m_overflow, [this](const IdType id) { found.add(id); });
+			}
+		}
+
+		return found;
+	}
+
+	// calls func for every id in the cells from minCell to maxCell (inclusive)
+	template<typename Func>
+	void forEachInCellRange(const sf::Vector2i minCell, const sf::Vector2i maxCell, Func&& func) const
+	{
+		const int64_t rangeCells = static_cast<int64_t>(maxCell.x - minCell.x + 1) * (maxCell.y - minCell.y + 1);
+
+		// big ranges over a sparse grid, walking the occupied cells is cheaper than probing every coordinate
+		if (rangeCells > m_cellCount)
+		{
+			for (const uint32_t slot : m_usedSlots)
+			{
+				const Slot& entry = m_table[slot];
+				if (entry.coords.x >= minCell.x && entry.coords.x <= maxCell.x && entry.coords.y >= minCell.y && entry.coords.y <= maxCell.y)
+					m_cells[entry.cell].forEach(m_overflow, func);
+			}
+			return;
+		}
+
+		for (int x = minCell.x; x <= maxCell.x; x++)
+		{
+			for (int y = minCell.y; y <= maxCell.y; y++)
+			{
+				if (const Cell* cell = getCell({ x, y }))
+					cell->forEach(m_overflow, func);
+			}
+		}
+	}
+
+	[[nodiscard]] const Cell* getCell(const sf::Vector2i coords) const
+	{
+		for (uint32_t slot = hash(coords) & m_mask;; slot = (slot + 1) & m_mask)
+		{
+			const Slot& entry = m_table[slot];
+			if (entry.cell == Pool::none)
+				return nullptr;
+			if (entry.coords == coords)
+				return &m_cells[entry.cell];
+		}
+	}
+
+	[[nodiscard]] sf::Vector2i posToCell(const sf::Vector2f position) const
+	{
+		return {
+			static_cast<int32_t>(std::floor(position.x * conversionFactor)),
+			static_cast<int32_t>(std::floor(position.y * conversionFactor))};
+	}
+
+	[[nodiscard]] uint32_t occupiedCells() const
+	{
+		return m_cellCount;
+	}
+
+
+private:
+	[[nodiscard]] static uint32_t hash(const sf::Vector2i coords)
+	{
+		// fibonacci hashing of both coordinates packed into one 64 bit key, the high bits are the best mixed
+		const uint64_t key = static_cast<uint64_t>(static_cast<uint32_t>(coords.x)) |
+			static_cast<uint64_t>(static_cast<uint32_t>(coords.y)) << 32;
+		return static_cast<uint32_t>((key * 0x9E3779B97F4A7C15ull) >> 32);
+	}
+
+	uint32_t findOrInsertCell(const sf::Vector2i coords)
+	{
+		uint32_t slot = hash(coords) & m_mask;
+		for (;; slot = (slot + 1) & m_mask)
+		{
+			const Slot& entry = m_table[slot];
+			if (entry.cell == Pool::none)
+				break;
+			if (entry.coords == coords)
+				return entry.cell;
+		}
+
+		if ((m_cellCount + 1) * 2 > m_table.size())
+		{
+			grow();
+			return findOrInsertCell(coords);
+		}
+
+		if (m_cellCount == m_cells.size())
+			m_cells.emplace_back();
+
+		m_cells[m_cellCount].clear();
+		m_table[slot] = { coords, m_cellCount };
+		m_usedSlots.push_back(slot);
+		return m_cellCount++;
+	}
+
+	void grow()
+	{
+		const std::vector<Slot> oldTable = std::move(m_table);
+
+		m_table.assign(oldTable.size() * 2, Slot{});
+		m_mask = static_cast<uint32_t>(m_table.size()) - 1;
+		m_usedSlots.clear();
+
+		for (const Slot& entry : oldTable)
+		{
+			if (entry.cell == Pool::none)
+				continue;
+
+			uint32_t slot = hash(entry.coords) & m_mask;
+			while (m_table[slot].cell != Pool::none)
+				slot = (slot + 1) & m_mask;
+
+			m_table[slot] = entry;
+			m_usedSlots.push_back(slot);
+		}
+	}
+};
+
+
+using HashedSpatialHashGrid = BasicHashedSpatialHashGrid<>;
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+#include <vector>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "hashedGrid.h"
+/*
+	HierarchicalSpatialHashGrid
+
+	Stack of hashed grids for entities with very different interaction radii.
+	Level L has cells of baseCellSize * 2^L, and an atom is stored in the lowest
+	level whose cells are at least as wide as its diameter. Small particles end up
+	in small cells and are no longer scanned by every query just because one big
+	agent forced the whole grid to use huge cells.
+
+	find(position, radius) returns every atom whose circle can overlap the query
+	circle. Every level is searched with the query radius plus the biggest radius
+	stored on that level, and levels without any atoms are skipped.
+*/
+
+
+template<typename IdType = int32_t, uint16_t CellCapacity = 20, typename CountType = uint8_t>
+struct BasicHierarchicalSpatialHashGrid
+{
+	using Level = BasicHashedSpatialHashGrid<IdType, CellCapacity, CountType>;
+	using Result = typename Level::Result;
+
+	std::vector<Level> m_levels{};
+	std::vector<float> m_maxRadius{};
+	std::vector<uint32_t> m_levelAtoms{};
+
+	float m_baseCellSize{};
+	Result found{};
+
+	// constructor and destructor
+	explicit BasicHierarchicalSpatialHashGrid(const float baseCellSize = 1.f, const uint32_t levels = 8)
+	{
+		init(baseCellSize, levels);
+	}
+	~BasicHierarchicalSpatialHashGrid() = default;
+
+
+	void init(const float baseCellSize, const uint32_t levels)
+	{
+		m_baseCellSize = baseCellSize;
+
+		m_levels.clear();
+		m_levels.reserve(levels);
+		for (uint32_t l{0}; l < levels; l++)
+			m_levels.emplace_back(m_baseCellSize * static_cast<float>(1u << l));
+
+		m_maxRadius.assign(levels, 0.f);
+		m_levelAtoms.assign(levels, 0);
+	}
+
+
+	// other functions
+	void addAtom(const sf::Vector2f pos, const float radius, const IdType atom)
+	{
+		const uint32_t level = levelFor(radius);
+
+		m_levels[level].addAtom(pos, atom);
+		m_maxRadius[level] = std::max(m_maxRadius[level], radius);
+		m_levelAtoms[level]++;
+	}
+
+	void clear()
+	{
+		for (uint32_t l{0}; l < m_levels.size(); l++)
+		{
+			if (m_levelAtoms[l] == 0)
+				continue;
+
+			m_levels[l].clear();
+			m_maxRadius[l] = 0.f;
+			m_levelAtoms[l] = 0;
+		}
+	}
+
+	Result& find(const sf::Vector2f position, const float radius)
+	{
+		found.size = 0;
+
+		for (uint32_t l{0}; l < m_levels.size(); l++)
+		{
+			if (m_levelAtoms[l] == 0)
+				continue;
+
+			const Level& level = m_levels[l];
+			const float reach = radius + m_maxRadius[l];
+
+			level.forEachInCellRange(
+				level.posToCell({ position.x - reach, position.y - reach }),
+				level.posToCell({ position.x + reach, position.y + reach }),
+				[this](const IdType id) { found.add(id); });
+		}
+
+		return found;
+	}
+
+	// lowest level with cells at least as wide as the diameter, radii past the top level share the top level
+	[[nodiscard]] uint32_t levelFor(const float radius) const
+	{
+		const float cells = 2.f * radius / m_baseCellSize;
+		if (cells <= 1.f)
+			return 0;
+
+		const auto level = static_cast<uint32_t>(std::ceil(std::log2(cells)));
+		return std::min(level, static_cast<uint32_t>(m_levels.size()) - 1);
+	}
+};
+
+
+using HierarchicalSpatialHashGrid = BasicHierarchicalSpatialHashGrid<>;
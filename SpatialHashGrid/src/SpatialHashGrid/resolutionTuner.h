@@ -0,0 +1,113 @@
+#pragma once
+
+#include <SFML/Graphics.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+/*
+	GridResolutionTuner
+
+	Keeps the cell size of a BasicSpatialHashGrid close to optimal while the density
+	of the simulation changes. Every m_interval frames it measures the atoms per cell
+	over the whole grid, the load of the fullest cell and the average number of
+	candidates a query returned. It picks a new resolution when the load is outside
+	the tolerance band around m_targetLoad, when a cell holds more than m_maxCellLoad
+	atoms or when the cells are smaller than m_minCellSize.
+
+	Resizing re-inits the grid, so update() returns true when the caller has to add
+	the atoms again.
+*/
+
+
+struct GridResolutionTuner
+{
+	// atoms per cell the tuner aims for
+	float m_targetLoad = 2.f;
+	// no resize while the load is within m_targetLoad * (1 -+ m_tolerance)
+	float m_tolerance = 0.5f;
+	// the grid is refined while a cell holds more than this, and never coarsened past it
+	uint32_t m_maxCellLoad = 16;
+	// cells never get smaller than this, find() needs the interaction radius to fit inside a cell
+	float m_minCellSize = 1.f;
+	uint32_t m_maxCellsPerAxis = 4096;
+	uint32_t m_interval = 60;
+
+	uint32_t m_framesSinceCheck = 0;
+
+	// measured at the last check
+	float m_averageLoad = 0.f;
+	uint32_t m_maxLoad = 0;
+	float m_averageCandidates = 0.f;
+
+	explicit GridResolutionTuner(const float minCellSize = 1.f, const float targetLoad = 2.f, const uint32_t interval = 60)
+		: m_targetLoad(targetLoad), m_minCellSize(minCellSize), m_interval(interval) {}
+
+
+	template<typename Grid>
+	bool update(Grid& grid)
+	{
+		if (++m_framesSinceCheck < m_interval)
+			return false;
+		m_framesSinceCheck = 0;
+
+		measure(grid);
+		grid.m_context.stats = {};
+
+		// a query reads 9 cells, so the candidates per query are the best measure of the load the queries actually see.
+		// forEachPair() doesn't count queries, then the atoms per cell have to do
+		const float load = m_averageCandidates > 0.f ? m_averageCandidates / 9.f : m_averageLoad;
+
+		// the load grows with the cell area, so each axis scales with the square root
+		float scale = 1.f;
+		if (load > 0.f && (load < m_targetLoad * (1.f - m_tolerance) || load > m_targetLoad * (1.f + m_tolerance)))
+			scale = std::sqrt(load / m_targetLoad);
+
+		// a crowded cell is refined even when the average is fine, aiming below m_maxCellLoad so the next check doesn't
+		// refine again. a coarser grid must not crowd a cell either
+		const float uncrowded = std::sqrt(static_cast<float>(m_maxLoad) / (static_cast<float>(m_maxCellLoad) * (1.f - m_tolerance)));
+		if (m_maxLoad > m_maxCellLoad)
+			scale = std::max(scale, uncrowded);
+		else if (scale < 1.f)
+			scale = std::min(std::max(scale, uncrowded), 1.f);
+
+		// clampCells() also shrinks a grid whose cells got smaller than m_minCellSize
+		const sf::Vector2u cells = {
+			clampCells(static_cast<float>(grid.m_cellsXY.x) * scale, grid.m_screenSize.width),
+			clampCells(static_cast<float>(grid.m_cellsXY.y) * scale, grid.m_screenSize.height) };
+
+		if (cells == grid.m_cellsXY)
+			return false;
+
+		grid.init(grid.m_screenSize, cells);
+		return true;
+	}
+
+
+private:
+	template<typename Grid>
+	void measure(const Grid& grid)
+	{
+		uint64_t atoms = 0;
+		m_maxLoad = 0;
+
+		grid.forEachOccupiedCell([&](const uint32_t idx)
+		{
+			const uint32_t load = grid.m_cells[idx].size(grid.m_overflow);
+			atoms += load;
+			m_maxLoad = std::max(m_maxLoad, load);
+		});
+
+		// over all the cells, the empty ones too. the mean of the occupied cells alone is never below 1
+		const uint64_t cells = static_cast<uint64_t>(grid.m_cellsXY.x) * grid.m_cellsXY.y;
+		m_averageLoad = cells > 0 ? static_cast<float>(atoms) / static_cast<float>(cells) : 0.f;
+		m_averageCandidates = grid.m_context.stats.queries > 0 ?
+			static_cast<float>(grid.m_context.stats.candidates) / static_cast<float>(grid.m_context.stats.queries) : 0.f;
+	}
+
+	[[nodiscard]] uint32_t clampCells(const float cells, const float length) const
+	{
+		const float maxCells = std::min(std::floor(length / m_minCellSize), static_cast<float>(m_maxCellsPerAxis));
+		return static_cast<uint32_t>(std::clamp(std::round(cells), 1.f, std::max(maxCells, 1.f)));
+	}
+};
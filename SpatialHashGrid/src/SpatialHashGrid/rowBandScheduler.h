@@ -0,0 +1,230 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+/*
+	RowBandScheduler
+
+	Runs a pass over the rows of a grid on a fixed set of worker threads. The rows
+	are cut into bands of a few contiguous rows and every worker starts with an
+	equal share of the bands, so it works on one part of the grid that is also
+	together in memory. A worker takes bands from the front of its own share, and
+	once that is empty it steals the back half of the biggest share left. A thread
+	that got a crowded part of the grid is helped out instead of holding up the
+	whole pass.
+
+	run() blocks until every band is done, the calling thread works as worker 0.
+*/
+
+
+struct RowBandScheduler
+{
+	// bands per worker, more bands balance better but every band is a separate call
+	static constexpr uint32_t bands_per_thread = 8;
+
+	// band indices [begin, end) left in a worker's share, packed into one word so the owner and the thieves
+	// both take bands with a single compare and swap. own cache line, the owner writes it for every band
+	struct alignas(64) Share
+	{
+		std::atomic<uint64_t> range{0};
+	};
+
+	std::vector<Share> m_shares;
+	std::vector<std::thread> m_workers{};
+
+	// the pass being run, func(rowBegin, rowEnd, worker) without the type
+	void* m_func = nullptr;
+	void (*m_invoke)(void*, uint32_t, uint32_t, uint32_t) = nullptr;
+	uint32_t m_rows = 0;
+	uint32_t m_bandRows = 1;
+
+	std::mutex m_mutex{};
+	std::condition_variable m_start{};
+	std::condition_variable m_done{};
+	uint64_t m_generation = 0;
+	uint32_t m_busy = 0;
+	bool m_stop = false;
+
+	// constructor and destructor
+	explicit RowBandScheduler(const uint32_t threads = std::thread::hardware_concurrency())
+		: m_shares(std::max(threads, 1u))
+	{
+		m_workers.reserve(m_shares.size() - 1);
+		for (uint32_t w{1}; w < m_shares.size(); w++)
+			m_workers.emplace_back([this, w] { workerLoop(w); });
+	}
+
+	~RowBandScheduler()
+	{
+		{
+			std::lock_guard lock(m_mutex);
+			m_stop = true;
+		}
+		m_start.notify_all();
+
+		for (std::thread& worker : m_workers)
+			worker.join();
+	}
+
+	RowBandScheduler(const RowBandScheduler&) = delete;
+	RowBandScheduler& operator=(const RowBandScheduler&) = delete;
+
+
+	[[nodiscard]] uint32_t threads() const
+	{
+		return static_cast<uint32_t>(m_shares.size());
+	}
+
+	// calls func(rowBegin, rowEnd, worker) for bands of rows covering [0, rows), worker is below threads()
+	template<typename Func>
+	void run(const uint32_t rows, Func&& func)
+	{
+		if (rows == 0)
+			return;
+
+		m_func = const_cast<void*>(static_cast<const void*>(&func));
+		m_invoke = [](void* f, const uint32_t rowBegin, const uint32_t rowEnd, const uint32_t worker)
+		{
+			(*static_cast<std::remove_reference_t<Func>*>(f))(rowBegin, rowEnd, worker);
+		};
+
+		const uint32_t workers = threads();
+		m_rows = rows;
+		m_bandRows = std::max(rows / (workers * bands_per_thread), 1u);
+
+		const uint32_t bands = (rows + m_bandRows - 1) / m_bandRows;
+		for (uint32_t w{0}; w < workers; w++)
+			m_shares[w].range.store(pack(bands * w / workers, bands * (w + 1) / workers), std::memory_order_relaxed);
+
+		if (workers == 1)
+		{
+			work(0);
+			return;
+		}
+
+		{
+			std::lock_guard lock(m_mutex);
+			m_busy = workers - 1;
+			m_generation++;
+		}
+		m_start.notify_all();
+
+		work(0);
+
+		std::unique_lock lock(m_mutex);
+		m_done.wait(lock, [this] { return m_busy == 0; });
+	}
+
+
+private:
+	[[nodiscard]] static uint64_t pack(const uint32_t begin, const uint32_t end)
+	{
+		return static_cast<uint64_t>(end) << 32 | begin;
+	}
+
+	void workerLoop(const uint32_t worker)
+	{
+		uint64_t seen = 0;
+		while (true)
+		{
+			{
+				std::unique_lock lock(m_mutex);
+				m_start.wait(lock, [&] { return m_stop || m_generation != seen; });
+				if (m_stop)
+					return;
+				seen = m_generation;
+			}
+
+			work(worker);
+
+			{
+				std::lock_guard lock(m_mutex);
+				if (--m_busy == 0)
+					m_done.notify_one();
+			}
+		}
+	}
+
+	void work(const uint32_t worker)
+	{
+		while (true)
+		{
+			uint32_t band;
+			if (takeFront(worker, band))
+			{
+				const uint32_t rowBegin = band * m_bandRows;
+				m_invoke(m_func, rowBegin, std::min(rowBegin + m_bandRows, m_rows), worker);
+			}
+			else if (!steal(worker))
+				return;
+		}
+	}
+
+	bool takeFront(const uint32_t worker, uint32_t& band)
+	{
+		std::atomic<uint64_t>& range = m_shares[worker].range;
+		uint64_t current = range.load(std::memory_order_acquire);
+
+		while (true)
+		{
+			const auto begin = static_cast<uint32_t>(current);
+			const auto end = static_cast<uint32_t>(current >> 32);
+			if (begin >= end)
+				return false;
+
+			if (range.compare_exchange_weak(current, pack(begin + 1, end), std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				band = begin;
+				return true;
+			}
+		}
+	}
+
+	// moves the back half of the biggest share left into this worker's empty share, false when there is nothing left
+	bool steal(const uint32_t worker)
+	{
+		while (true)
+		{
+			uint32_t victim = 0;
+			uint32_t most = 0;
+			uint64_t victimRange = 0;
+
+			for (uint32_t w{0}; w < threads(); w++)
+			{
+				if (w == worker)
+					continue;
+
+				const uint64_t current = m_shares[w].range.load(std::memory_order_acquire);
+				const auto begin = static_cast<uint32_t>(current);
+				const auto end = static_cast<uint32_t>(current >> 32);
+				if (end > begin && end - begin > most)
+				{
+					victim = w;
+					most = end - begin;
+					victimRange = current;
+				}
+			}
+
+			if (most == 0)
+				return false;
+
+			const auto begin = static_cast<uint32_t>(victimRange);
+			const auto end = static_cast<uint32_t>(victimRange >> 32);
+			const uint32_t split = end - (most + 1) / 2;
+
+			// the victim took a band or someone else stole first, look again
+			if (m_shares[victim].range.compare_exchange_strong(victimRange, pack(begin, split), std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				m_shares[worker].range.store(pack(split, end), std::memory_order_release);
+				return true;
+			}
+		}
+	}
+};
@@ -3,15 +3,20 @@
 #include <SFML/Graphics.hpp>
 #include <vector>
 
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
 #include <cstdint>
 #include <iostream>
+#include <limits>
+#include <type_traits>
+#include <utility>
 /*
 	SpatialHashGrid
 
 	Improvements:
-	- make a check visual range function
 	- make a way to return the cells within visual range
-	- automatic resolution resizer
 
 	Notes:
 	FINAL GOAL: 50k particles at 144fps
@@ -27,60 +32,475 @@
 */
 
 
-// https://github.com/johnBuffer/VerletSFML-Multithread/blob/main/src/physics/collision_grid.hpp
-struct CollisionCell
+// positions kept next to the ids when a grid is built with StorePositions, so distance checks can run on grid
+// memory alone. the empty version takes no space
+template<uint16_t Capacity, bool StorePositions>
+struct SlotPositions
+{
+	void setPosition(unsigned, sf::Vector2f) {}
+};
+
+template<uint16_t Capacity>
+struct SlotPositions<Capacity, true>
+{
+	sf::Vector2f positions[Capacity] = {};
+
+	void setPosition(const unsigned index, const sf::Vector2f position)
+	{
+		positions[index] = position;
+	}
+};
+
+
+// overflow storage for cells that fill up their inline slots
+template<typename IdType, bool StorePositions = false>
+struct OverflowChunk : SlotPositions<16, StorePositions>
 {
-	// cell_capacity is the absolute MAXIMUM amount of objects that will be in this cell
-	static constexpr uint8_t cell_capacity = 20;
-	static constexpr uint8_t max_cell_idx = cell_capacity - 1;
+	static constexpr uint8_t chunk_capacity = 16;
 
 	uint8_t objects_count = 0;
-	int32_t objects[cell_capacity] = {};
+	IdType objects[chunk_capacity] = {};
+	uint32_t next = 0;
+};
+
+
+// per frame arena of overflow chunks, cleared together with the grid so no memory is freed between frames.
+// chunks emptied by move() go onto a free list so a grid that is never cleared doesn't keep growing
+template<typename IdType, bool StorePositions = false>
+struct OverflowPool
+{
+	using Chunk = OverflowChunk<IdType, StorePositions>;
+	static constexpr uint32_t none = UINT32_MAX;
+
+	std::vector<Chunk> m_chunks{};
+	uint32_t m_used = 0;
+	uint32_t m_free = none;
+
+	uint32_t allocate(const uint32_t next)
+	{
+		uint32_t index = m_free;
+		if (index != none)
+			m_free = m_chunks[index].next;
+		else
+		{
+			if (m_used == m_chunks.size())
+				m_chunks.emplace_back();
+			index = m_used++;
+		}
+
+		Chunk& chunk = m_chunks[index];
+		chunk.objects_count = 0;
+		chunk.next = next;
+		return index;
+	}
+
+	// allocate() for several threads at once. only hands out chunks that reserve() made beforehand, m_chunks can't
+	// grow while other threads use it, and chunks on the free list are not reused
+	uint32_t allocateConcurrent(const uint32_t next)
+	{
+		std::atomic_ref<uint32_t> used(m_used);
+		const uint32_t index = used.fetch_add(1, std::memory_order_relaxed);
+		if (index >= m_chunks.size())
+		{
+			// give the slot back, allocate() grows the pool only when m_used is exactly at its end
+			used.fetch_sub(1, std::memory_order_relaxed);
+			throw std::length_error("allocateConcurrent() ran out of reserved overflow chunks");
+		}
+
+		Chunk& chunk = m_chunks[index];
+		chunk.objects_count = 0;
+		chunk.next = next;
+		return index;
+	}
+
+	// makes sure count more chunks can be handed out without growing m_chunks
+	void reserve(const uint32_t count)
+	{
+		if (m_chunks.size() < static_cast<size_t>(m_used) + count)
+			m_chunks.resize(static_cast<size_t>(m_used) + count);
+	}
+
+	void release(const uint32_t index)
+	{
+		m_chunks[index].next = m_free;
+		m_free = index;
+	}
+
+	Chunk& operator[](const uint32_t index) { return m_chunks[index]; }
+	const Chunk& operator[](const uint32_t index) const { return m_chunks[index]; }
+
+	void clear()
+	{
+		m_used = 0;
+		m_free = none;
+	}
+};
+
+
+// https://github.com/johnBuffer/VerletSFML-Multithread/blob/main/src/physics/collision_grid.hpp
+template<typename IdType = int32_t, uint16_t CellCapacity = 20, typename CountType = uint8_t, bool StorePositions = false>
+struct CollisionCell : SlotPositions<CellCapacity, StorePositions>
+{
+	static_assert(std::is_integral_v<IdType>, "CollisionCell ids must be integers");
+	static_assert(CellCapacity > 0 && CellCapacity <= std::numeric_limits<CountType>::max(),
+		"CountType is too narrow to count CellCapacity objects");
+
+	using Pool = OverflowPool<IdType, StorePositions>;
+	static constexpr bool stores_positions = StorePositions;
+
+	// cell_capacity is the amount of objects stored inline, anything past that spills into the overflow pool
+	static constexpr uint16_t cell_capacity = CellCapacity;
+
+	CountType objects_count = 0;
+	IdType objects[cell_capacity] = {};
+
+	// most recently allocated overflow chunk, chained to the older ones through OverflowChunk::next
+	uint32_t overflow = Pool::none;
 
 	CollisionCell() = default;
 
-	void addAtom(const int32_t id)
+	// returns the slot the id was stored in, slots past cell_capacity encode chunk * chunk_capacity + index.
+	// position is only kept when the cell stores positions
+	uint32_t addAtom(const IdType id, Pool& pool, const sf::Vector2f position = {})
+	{
+		if (objects_count < cell_capacity)
+		{
+			objects[objects_count] = id;
+			this->setPosition(objects_count, position);
+			return objects_count++;
+		}
+
+		if (overflow == Pool::none || pool[overflow].objects_count == Pool::Chunk::chunk_capacity)
+			overflow = pool.allocate(overflow);
+
+		typename Pool::Chunk& chunk = pool[overflow];
+		chunk.objects[chunk.objects_count] = id;
+		chunk.setPosition(chunk.objects_count, position);
+		return overflowSlot(overflow, chunk.objects_count++);
+	}
+
+	// addAtom() for several threads adding to cells of the same pool at once. the inline slot is reserved with compare
+	// and swap on objects_count, past that the slot is reserved in the newest chunk the same way, or a new chunk is
+	// published with compare and swap on overflow. a new chunk that loses that race is kept for the next try, and is
+	// only left unused if the winner's chunk still has room
+	uint32_t addAtomConcurrent(const IdType id, Pool& pool, const sf::Vector2f position = {})
+	{
+		std::atomic_ref<CountType> count(objects_count);
+		CountType index = count.load(std::memory_order_relaxed);
+		while (index < cell_capacity)
+		{
+			if (count.compare_exchange_weak(index, static_cast<CountType>(index + 1), std::memory_order_relaxed))
+			{
+				objects[index] = id;
+				this->setPosition(index, position);
+				return index;
+			}
+		}
+
+		std::atomic_ref<uint32_t> newest(overflow);
+		uint32_t spare = Pool::none;
+		while (true)
+		{
+			uint32_t head = newest.load(std::memory_order_acquire);
+			if (head != Pool::none)
+			{
+				typename Pool::Chunk& chunk = pool[head];
+				std::atomic_ref<uint8_t> chunkCount(chunk.objects_count);
+				uint8_t chunkIndex = chunkCount.load(std::memory_order_relaxed);
+				while (chunkIndex < Pool::Chunk::chunk_capacity)
+				{
+					if (chunkCount.compare_exchange_weak(chunkIndex, static_cast<uint8_t>(chunkIndex + 1), std::memory_order_relaxed))
+					{
+						chunk.objects[chunkIndex] = id;
+						chunk.setPosition(chunkIndex, position);
+						return overflowSlot(head, chunkIndex);
+					}
+				}
+			}
+
+			if (spare == Pool::none)
+				spare = pool.allocateConcurrent(head);
+
+			// the id goes in before the chunk is published, other threads only see it with slot 0 taken
+			typename Pool::Chunk& chunk = pool[spare];
+			chunk.next = head;
+			chunk.objects_count = 1;
+			chunk.objects[0] = id;
+			chunk.setPosition(0, position);
+
+			if (newest.compare_exchange_strong(head, spare, std::memory_order_release, std::memory_order_relaxed))
+				return overflowSlot(spare, 0);
+		}
+	}
+
+	// removes the id in slot by moving the cell's last id into it. returns true and sets movedId if an id
+	// changed slot, false if the removed id was the last one
+	bool removeAt(const uint32_t slot, Pool& pool, IdType& movedId)
+	{
+		uint32_t lastSlot;
+
+		// only the newest chunk can be partially filled, so the last id is always at its end.
+		// a released chunk keeps its contents until it is allocated again, so the last id can still be read below
+		if (overflow != Pool::none)
+		{
+			typename Pool::Chunk& chunk = pool[overflow];
+			lastSlot = overflowSlot(overflow, --chunk.objects_count);
+
+			if (chunk.objects_count == 0)
+			{
+				const uint32_t emptied = overflow;
+				overflow = chunk.next;
+				pool.release(emptied);
+			}
+		}
+		else
+		{
+			lastSlot = --objects_count;
+		}
+
+		if (lastSlot == slot)
+			return false;
+
+		movedId = atSlot(lastSlot, pool);
+		atSlot(slot, pool) = movedId;
+		if constexpr (StorePositions)
+			positionAt(slot, pool) = positionAt(lastSlot, pool);
+
+		return true;
+	}
+
+	IdType& atSlot(const uint32_t slot, Pool& pool)
+	{
+		if (slot < cell_capacity)
+			return objects[slot];
+
+		const uint32_t offset = slot - cell_capacity;
+		return pool[offset / Pool::Chunk::chunk_capacity].objects[offset % Pool::Chunk::chunk_capacity];
+	}
+
+	sf::Vector2f& positionAt(const uint32_t slot, Pool& pool) requires StorePositions
+	{
+		if (slot < cell_capacity)
+			return this->positions[slot];
+
+		const uint32_t offset = slot - cell_capacity;
+		return pool[offset / Pool::Chunk::chunk_capacity].positions[offset % Pool::Chunk::chunk_capacity];
+	}
+
+	[[nodiscard]] static uint32_t overflowSlot(const uint32_t chunk, const uint32_t index)
+	{
+		return cell_capacity + chunk * Pool::Chunk::chunk_capacity + index;
+	}
+
+	template<typename Func>
+	void forEach(const Pool& pool, Func&& func) const
+	{
+		for (unsigned i{0}; i < objects_count; i++)
+			func(objects[i]);
+
+		for (uint32_t c = overflow; c != Pool::none; c = pool[c].next)
+		{
+			const typename Pool::Chunk& chunk = pool[c];
+			for (unsigned i{0}; i < chunk.objects_count; i++)
+				func(chunk.objects[i]);
+		}
+	}
+
+	template<typename Func>
+	void forEachWithPosition(const Pool& pool, Func&& func) const requires StorePositions
+	{
+		for (unsigned i{0}; i < objects_count; i++)
+			func(objects[i], this->positions[i]);
+
+		for (uint32_t c = overflow; c != Pool::none; c = pool[c].next)
+		{
+			const typename Pool::Chunk& chunk = pool[c];
+			for (unsigned i{0}; i < chunk.objects_count; i++)
+				func(chunk.objects[i], chunk.positions[i]);
+		}
+	}
+
+	[[nodiscard]] bool empty() const
+	{
+		return objects_count == 0;
+	}
+
+	[[nodiscard]] uint32_t size(const Pool& pool) const
 	{
-		objects[objects_count] = id;
-		objects_count += objects_count < max_cell_idx;
+		uint32_t count = objects_count;
+		for (uint32_t c = overflow; c != Pool::none; c = pool[c].next)
+			count += pool[c].objects_count;
+		return count;
 	}
 
 	void clear()
 	{
 		objects_count = 0;
+		overflow = Pool::none;
 	}
 };
 
 
+// growable result buffer, keeps its memory between queries
+template<typename IdType = int32_t, uint32_t InitialCapacity = 20 * 9>
 struct c_Vec
 {
-	static constexpr uint8_t max = CollisionCell::cell_capacity * 9;
-	int32_t array[max] = {};
-	uint8_t size = 0;
+	static constexpr uint32_t initial_capacity = InitialCapacity;
+	std::vector<IdType> array = std::vector<IdType>(initial_capacity);
+	uint32_t size = 0;
 
-	void add(const int32_t value)
+	void add(const IdType value)
 	{
-		if (size >= max)
-			return;
+		if (size == array.size())
+			array.resize(array.size() * 2);
 
 		array[size] = value;
 		size++;
 	}
 
-	[[nodiscard]] int32_t at(const unsigned index) const
+	[[nodiscard]] IdType at(const unsigned index) const
 	{
 		return array[index];
 	}
 };
 
 
-struct SpatialHashGrid
+// order the cells are stored in
+enum class CellLayout
+{
+	RowMajor, // x + y * width, the 3x3 block is spread over 3 rows
+	Morton,   // z curve over a power of two square, keeps 2d neighbours close at every scale
+	Tiled     // 4x4 tiles stored one after another, a 3x3 block touches at most 4 tiles
+};
+
+
+/*
+	The grid is specialised at compile time on:
+	- IdType       : integer type of the stored ids, uint16_t halves the cell size for small simulations
+	- CellCapacity : inline slots per cell before spilling into the overflow pool
+	- CountType    : per cell counter, must be able to hold CellCapacity
+	- Layout       : order of the cells in memory, see CellLayout
+	- StorePositions : keep each atom's position next to its id, needed by findWithin()
+*/
+template<typename IdType = int32_t, uint16_t CellCapacity = 20, typename CountType = uint8_t,
+	CellLayout Layout = CellLayout::RowMajor, bool StorePositions = false>
+struct BasicSpatialHashGrid
 {
-	std::vector<CollisionCell> m_cells{};
+	using Cell = CollisionCell<IdType, CellCapacity, CountType, StorePositions>;
+	using Pool = typename Cell::Pool;
+	using Result = c_Vec<IdType, CellCapacity * 9>;
+
+	// where every atom currently lives, indexed by id, so move() can find it without searching
+	struct AtomHandle
+	{
+		sf::Vector2<uint32_t> cell{};
+		uint32_t slot = Pool::none;
+	};
+
+	std::vector<Cell> m_cells{};
+	Pool m_overflow{};
+	std::vector<AtomHandle> m_handles{};
+
+	// one bit per cell in storage order, set while the cell holds atoms. every word of 64 cells is stamped
+	// with the epoch it was last written in, words from an older epoch count as empty, so clear() only has
+	// to bump m_epoch. cells are never cleared by clear(), the first insert into a word from an older epoch
+	// empties its 64 cells, so a cell whose bit is not set is always empty
+	struct OccupancyWord
+	{
+		uint64_t bits = 0;
+		uint32_t epoch = 0;
+	};
+
+	// stamp of a word that addAtomConcurrent() is emptying, never used as an epoch
+	static constexpr uint32_t resetting_epoch = std::numeric_limits<uint32_t>::max();
+
+	std::vector<OccupancyWord> m_occupied{};
+	uint32_t m_epoch = 1;
 	sf::Vector2u m_cellsXY{};
 
+	// the cells are stored with a border of one cell that never holds atoms, so the 3x3 block around any cell is
+	// always inside the storage and needs no bounds checks. storage coordinates are the cell coordinates + 1
+	static constexpr uint32_t ghost_cells = 1;
+
+	static constexpr uint32_t tile_size = 4;
+	uint32_t m_tilesX = 0;
+
+	// storage offsets of the 3x3 block from its center, row major needs one set, tiled one per position in the tile
+	int32_t m_neighbourOffsets[tile_size * tile_size][9] = {};
+
+	// coordinates of the last cell, posTo2dIdx() clamps to them
+	sf::Vector2f m_lastCell{};
+
+	// query counters, the ones of m_context are read and reset by GridResolutionTuner
+	struct QueryStats
+	{
+		uint64_t queries = 0;
+		uint64_t candidates = 0;
+	};
+
+	// how far (in cells) an atom may leave its cell before move() re-bins it. atoms can then be up to this much
+	// outside the cell they are stored in, so find() only covers interaction radii up to (1 - m_hysteresis) cells
+	float m_hysteresis = 0.f;
+
+	// results of a batch query, the ids for query i are ids[offsets[i]] .. ids[offsets[i + 1]]
+	struct NeighbourLists
+	{
+		std::vector<uint32_t> offsets{};
+		std::vector<IdType> ids{};
+	};
+
+	// a circle crossed by a ray, distance is measured along the ray up to where it enters the circle
+	struct RayHit
+	{
+		IdType id{};
+		float distance = 0.f;
+	};
+	using RayHits = c_Vec<RayHit, 64>;
+
+	struct Ray
+	{
+		sf::Vector2f start{};
+		sf::Vector2f end{};
+	};
+
+	// results of a batch raycast, the hits of ray i are hits[offsets[i]] .. hits[offsets[i + 1]]
+	struct RayHitLists
+	{
+		std::vector<uint32_t> offsets{};
+		std::vector<RayHit> hits{};
+	};
+
+	// findAll() and batch findKNearest() scratch, the queries sorted by the storage index of their cell (counting sort)
+	std::vector<uint32_t> m_batchKeys{};
+	std::vector<uint32_t> m_batchOrder{};
+	std::vector<uint32_t> m_batchCellStart{};
+	// batch findKNearest() results in cell order, before they are moved into query order
+	std::vector<IdType> m_batchIds{};
+
+	// everything a query writes to. the queries that take a context are const, so any number of threads can query
+	// the same grid at once as long as each one has its own context. the queries without one use m_context
+	struct QueryContext
+	{
+		Result found{};
+
+		// max heap of (squared distance, id) used by findKNearest()
+		std::vector<std::pair<float, IdType>> nearest{};
+
+		// raycast() state. hits that are found but can't be reported yet wait in a min heap, and every id tested by
+		// the current ray is stamped with rayStamp so the overlapping 3x3 blocks don't test it twice
+		RayHits rayHits{};
+		std::vector<RayHit> rayPending{};
+		std::vector<uint32_t> rayStamps{};
+		uint32_t rayStamp = 0;
+
+		// ids of the cell forEachPair() is working on
+		std::vector<IdType> pairIds{};
+
+		QueryStats stats{};
+	};
+	QueryContext m_context{};
+
 	sf::Vector2f conversionFactor{};
-	c_Vec found{};
 
 	// graphics
 	sf::Vector2f m_cellDimensions{};
@@ -88,11 +508,11 @@ struct SpatialHashGrid
 	sf::VertexBuffer m_renderGrid{};
 
 	// constructor and destructor
-	explicit SpatialHashGrid(const sf::Rect<float> screenSize = {}, const sf::Vector2u cellsXY = {})
+	explicit BasicSpatialHashGrid(const sf::Rect<float> screenSize = {}, const sf::Vector2u cellsXY = {})
 	{
 		init(screenSize, cellsXY);
 	}
-	~SpatialHashGrid() = default;
+	~BasicSpatialHashGrid() = default;
 
 
 	void init(const sf::Rect<float> screenSize, const sf::Vector2u cellsXY)
@@ -100,107 +520,1189 @@ struct SpatialHashGrid
 		m_cellsXY = cellsXY;
 		m_screenSize = screenSize;
 
-		m_cells.resize(m_cellsXY.x * m_cellsXY.y);
+		m_tilesX = (m_cellsXY.x + 2 * ghost_cells + tile_size - 1) / tile_size;
+		m_cells.resize(storageSize());
+		for (Cell& cell : m_cells) {
+			cell.clear();
+		}
+		m_occupied.assign((m_cells.size() + 63) / 64, OccupancyWord{});
+		m_epoch = 1;
+		m_overflow.clear();
+		initNeighbourOffsets();
 
 		m_cellDimensions = { m_screenSize.width / static_cast<float>(m_cellsXY.x),
 							m_screenSize.height / static_cast<float>(m_cellsXY.y) };
 
 		conversionFactor = { 1.f / m_cellDimensions.x, 1.f / m_cellDimensions.y };
+		m_lastCell = { static_cast<float>(m_cellsXY.x) - 1.f, static_cast<float>(m_cellsXY.y) - 1.f };
 
 		initVertexBuffer();
 	}
 
 
 	// other functions
-	void addAtom(const sf::Vector2f pos, const int32_t atom)
+	void addAtom(const sf::Vector2f pos, const IdType atom)
+	{
+		if (!insideGrid(pos))
+			throw std::out_of_range("addAtom() position argument out of range");
+
+		insert(posTo2dIdx(pos), atom, pos);
+	}
+
+	// addAtom() that any number of threads can call at once without locks. slots are reserved with compare and swap
+	// on the cell counts, overflow chunks are taken from the ones reserveConcurrent() made and the occupancy bits are
+	// set with an atomic or. ids have to be below the reserved amount, and queries and move() have to wait until
+	// every inserting thread is done
+	void addAtomConcurrent(const sf::Vector2f pos, const IdType atom)
 	{
+		if (!insideGrid(pos))
+			throw std::out_of_range("addAtomConcurrent() position argument out of range");
+
 		const sf::Vector2<uint32_t> cIdx = posTo2dIdx(pos);
 
-		if (!checkValidIndex(cIdx))
-			throw std::out_of_range("find() position argument out of range");
+		const auto index = static_cast<size_t>(atom);
+		if (index >= m_handles.size())
+			throw std::out_of_range("addAtomConcurrent() id past the reserved atoms");
 
 		const uint32_t idx = idx2dTo1d(cIdx);
-		m_cells[idx].addAtom(atom);
+		acquireWordConcurrent(idx / 64);
+
+		const uint32_t slot = m_cells[idx].addAtomConcurrent(atom, m_overflow, pos);
+		std::atomic_ref<uint64_t>(m_occupied[idx / 64].bits).fetch_or(uint64_t{1} << (idx % 64), std::memory_order_relaxed);
+
+		m_handles[index] = { cIdx, slot };
+	}
+
+	// has to be called before addAtomConcurrent(), nothing can grow while several threads insert.
+	// ids go up to atoms - 1 and overflowChunks chunks of 16 ids are kept for full cells
+	void reserveConcurrent(const size_t atoms, const uint32_t overflowChunks)
+	{
+		if (m_handles.size() < atoms)
+			m_handles.resize(atoms);
+		m_overflow.reserve(overflowChunks);
+	}
+
+	// re-bins an atom added with addAtom(), the grid is only written to when the atom changes cell
+	void move(const IdType atom, const sf::Vector2f newPos)
+	{
+		if (!insideGrid(newPos))
+			throw std::out_of_range("move() position argument out of range");
+
+		AtomHandle& handle = m_handles[static_cast<size_t>(atom)];
+		const sf::Vector2<uint32_t> cIdx = posTo2dIdx(newPos);
+
+		// the stored position has to follow the atom even when it stays in its cell
+		if constexpr (StorePositions)
+			m_cells[idx2dTo1d(handle.cell)].positionAt(handle.slot, m_overflow) = newPos;
+
+		if (cIdx == handle.cell)
+			return;
+
+		// stay put while jittering just over the border
+		if (m_hysteresis > 0.f)
+		{
+			const float cellX = newPos.x * conversionFactor.x - static_cast<float>(handle.cell.x);
+			const float cellY = newPos.y * conversionFactor.y - static_cast<float>(handle.cell.y);
+
+			if (cellX > -m_hysteresis && cellX < 1.f + m_hysteresis && cellY > -m_hysteresis && cellY < 1.f + m_hysteresis)
+				return;
+		}
+
+		const uint32_t oldIdx = idx2dTo1d(handle.cell);
+		Cell& oldCell = m_cells[oldIdx];
+
+		IdType movedId;
+		if (oldCell.removeAt(handle.slot, m_overflow, movedId))
+			m_handles[static_cast<size_t>(movedId)].slot = handle.slot;
+
+		if (oldCell.empty())
+			m_occupied[oldIdx / 64].bits &= ~(uint64_t{1} << (oldIdx % 64));
+
+		insert(cIdx, atom, newPos);
 	}
 
+	void setHysteresis(const float cellFraction)
+	{
+		m_hysteresis = cellFraction;
+	}
+
+	// O(1), starts a new epoch which makes every cell empty
 	void clear()
 	{
-		for (CollisionCell& cell : m_cells) {
-			cell.objects_count = 0;
+		// after 2^32 clears the stamps would start matching again
+		if (++m_epoch == resetting_epoch)
+		{
+			std::fill(m_occupied.begin(), m_occupied.end(), OccupancyWord{});
+			m_epoch = 1;
 		}
+		m_overflow.clear();
 	}
 
-	c_Vec& find(const sf::Vector2f position)
+	[[nodiscard]] uint64_t occupiedWord(const uint32_t word) const
 	{
-		found.size = 0;
+		const OccupancyWord& entry = m_occupied[word];
+		return entry.epoch == m_epoch ? entry.bits : 0;
+	}
 
-		const sf::Vector2<uint32_t> cIdx = posTo2dIdx(position);
-		if (!checkValidIndex(cIdx))
-			throw std::out_of_range("find() position argument out of range");
+	[[nodiscard]] bool isOccupied(const uint32_t idx) const
+	{
+		return occupiedWord(idx / 64) >> (idx % 64) & 1;
+	}
 
-		// getting the indexes needed
-		for (unsigned x = cIdx.x - 1; x <= cIdx.x + 1; x++)
+	// calls func with the storage index of every cell that holds atoms, in storage order
+	template<typename Func>
+	void forEachOccupiedCell(Func&& func) const
+	{
+		for (uint32_t w{0}; w < m_occupied.size(); w++)
+		{
+			for (uint64_t bits = occupiedWord(w); bits != 0; bits &= bits - 1)
+				func(w * 64 + static_cast<uint32_t>(std::countr_zero(bits)));
+		}
+	}
+
+	// calls func(idx, cell) with the storage index and coordinates of every occupied cell from minIdx to maxIdx (inclusive)
+	template<typename Func>
+	void forEachOccupiedInRange(const sf::Vector2<uint32_t> minIdx, const sf::Vector2<uint32_t> maxIdx, Func&& func) const
+	{
+		for (uint32_t y = minIdx.y; y <= maxIdx.y; y++)
 		{
-			for (unsigned y = cIdx.y - 1; y <= cIdx.y + 1; y++)
+			if constexpr (Layout == CellLayout::RowMajor)
 			{
-				const CollisionCell& cell = m_cells[idx2dTo1d({ x, y })];
+				// a row is a contiguous run of bits, so whole empty words are skipped at once
+				const uint32_t first = idx2dTo1d({ minIdx.x, y });
+				const uint32_t last = idx2dTo1d({ maxIdx.x, y });
+
+				for (uint32_t w = first / 64; w <= last / 64; w++)
+				{
+					uint64_t bits = occupiedWord(w);
+					if (w == first / 64)
+						bits &= ~uint64_t{0} << (first % 64);
+					if (w == last / 64)
+						bits &= ~uint64_t{0} >> (63 - last % 64);
 
-				for (unsigned i{0}; i < cell.objects_count; i++)
-					found.add(cell.objects[i]);
+					for (; bits != 0; bits &= bits - 1)
+					{
+						const uint32_t idx = w * 64 + static_cast<uint32_t>(std::countr_zero(bits));
+						func(idx, sf::Vector2<uint32_t>{ minIdx.x + (idx - first), y });
+					}
+				}
+			}
+			else
+			{
+				for (uint32_t x = minIdx.x; x <= maxIdx.x; x++)
+				{
+					if (const uint32_t idx = idx2dTo1d({ x, y }); isOccupied(idx))
+						func(idx, sf::Vector2<uint32_t>{ x, y });
+				}
 			}
 		}
-
-		return found;
 	}
 
-	[[nodiscard]] uint32_t idx2dTo1d(const sf::Vector2<uint32_t> idx) const
+	// adds the counters of a worker thread's context to the grid's own, so GridResolutionTuner sees its queries too
+	void mergeStats(QueryContext& context)
 	{
-		return idx.x + idx.y * m_cellsXY.x;
+		m_context.stats.queries += context.stats.queries;
+		m_context.stats.candidates += context.stats.candidates;
+		context.stats = {};
 	}
 
-	[[nodiscard]] sf::Vector2<uint32_t> posTo2dIdx(const sf::Vector2f position) const
+	Result& find(const sf::Vector2f position)
 	{
-		return {
-			static_cast<uint32_t>(position.x * conversionFactor.x),
-			static_cast<uint32_t>(position.y * conversionFactor.y)};
+		return find(position, m_context);
 	}
 
-	[[nodiscard]] bool checkValidIndex(const sf::Vector2u index) const
+	Result& find(const sf::Vector2f position, QueryContext& context) const
 	{
-		return !(index.x < 0 || index.y < 0 || index.x >= m_cellsXY.x || index.y >= m_cellsXY.y);
+		Result& found = context.found;
+		found.size = 0;
+		forEachNear(position, context, [&found](const IdType id) { found.add(id); });
+		return found;
 	}
 
-
-	void initVertexBuffer()
+	// calls func(id) for every atom in the 3x3 block around position, straight from the cells. nothing is copied
+	// and there is no limit on the amount of atoms, and it's safe to run other queries from inside func
+	template<typename Func>
+	void forEachNear(const sf::Vector2f position, Func&& func)
 	{
-		std::vector<sf::Vertex> vertices(static_cast<std::vector<sf::Vertex>::size_type>((m_cellsXY.x + m_cellsXY.y) * 2));
+		forEachNear(position, m_context, func);
+	}
 
-		m_renderGrid = sf::VertexBuffer(sf::Lines, sf::VertexBuffer::Static);
-		m_renderGrid.create(vertices.size());
+	template<typename Func>
+	void forEachNear(const sf::Vector2f position, QueryContext& context, Func&& func) const
+	{
+		// getting the indexes needed
+		uint32_t indices[9];
+		neighbourIndices(posTo2dIdx(position), indices);
 
-		size_t counter = 0;
-		for (unsigned i = 0; i < m_cellsXY.x; i++)
+		uint32_t candidates = 0;
+		for (const uint32_t idx : indices)
 		{
-			const float posX = static_cast<float>(i) * m_cellDimensions.x;
-			vertices[counter].position = { posX, 0 };
-			vertices[counter + 1].position = { m_screenSize.left + posX, m_screenSize.top + m_screenSize.height };
-			counter += 2;
+			if (!isOccupied(idx))
+				continue;
+
+			m_cells[idx].forEach(m_overflow, [&](const IdType id)
+			{
+				func(id);
+				candidates++;
+			});
 		}
 
-		for (unsigned i = 0; i < m_cellsXY.y; i++)
+		context.stats.queries++;
+		context.stats.candidates += candidates;
+	}
+
+	// forEachNear() that only calls func(id, position) for the atoms within radius of position. radius can't be
+	// bigger than (1 - m_hysteresis) cells. positionOf(id) returns the position of an atom, grids that store
+	// positions use those instead
+	template<typename PositionOf, typename Func> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	void forEachWithin(const sf::Vector2f position, const float radius, PositionOf&& positionOf, Func&& func)
+	{
+		forEachWithin(position, radius, positionOf, m_context, func);
+	}
+
+	template<typename PositionOf, typename Func> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	void forEachWithin(const sf::Vector2f position, const float radius, PositionOf&& positionOf, QueryContext& context, Func&& func) const
+	{
+		uint32_t indices[9];
+		neighbourIndices(posTo2dIdx(position), indices);
+
+		const float radiusSquared = radius * radius;
+		uint32_t candidates = 0;
+		for (const uint32_t idx : indices)
 		{
-			const float posY = static_cast<float>(i) * m_cellDimensions.y;
-			vertices[counter].position = { 0, posY };
-			vertices[counter + 1].position = { m_screenSize.left + m_screenSize.width, m_screenSize.top + posY };
-			counter += 2;
+			if (!isOccupied(idx))
+				continue;
+
+			forEachInCell(idx, positionOf, [&](const IdType id, const sf::Vector2f atomPos)
+			{
+				const float dx = atomPos.x - position.x;
+				const float dy = atomPos.y - position.y;
+				if (dx * dx + dy * dy <= radiusSquared)
+					func(id, atomPos);
+				candidates++;
+			});
 		}
 
-		m_renderGrid.update(vertices.data(), vertices.size(), 0);
+		context.stats.queries++;
+		context.stats.candidates += candidates;
 	}
 
+	template<typename Func>
+	void forEachWithin(const sf::Vector2f position, const float radius, Func&& func) requires StorePositions
+	{
+		forEachWithin(position, radius, [](const IdType) { return sf::Vector2f{}; }, m_context, func);
+	}
 
-	void reSize(const sf::Rect<float> screenSize)
+	template<typename Func>
+	void forEachWithin(const sf::Vector2f position, const float radius, QueryContext& context, Func&& func) const requires StorePositions
 	{
-		init(screenSize, m_cellsXY);
+		forEachWithin(position, radius, [](const IdType) { return sf::Vector2f{}; }, context, func);
 	}
-};
+
+	// calls func(a, b) once for every unordered pair of atoms in the same or in neighbouring cells. every cell is
+	// paired with itself and the 4 neighbours after it (right and the 3 below), so each pair of neighbouring cells is
+	// only visited from one side and symmetric interactions do half the work of a find() per atom. both atoms of a
+	// pair can linger outside their cells, so with hysteresis only pairs up to (1 - 2 * m_hysteresis) cells apart are complete
+	template<typename Func>
+	void forEachPair(Func&& func)
+	{
+		forEachPairInRows(0, m_cellsXY.y, m_context, func);
+	}
+
+	// forEachPair() for the cells in rows [rowBegin, rowEnd) only. the rows below rowEnd are still read for the pairs
+	// that cross it, so bands of rows can be run on different threads, each with its own context
+	template<typename Func>
+	void forEachPairInRows(const uint32_t rowBegin, const uint32_t rowEnd, QueryContext& context, Func&& func) const
+	{
+		if (m_cellsXY.x == 0 || rowBegin >= std::min(rowEnd, m_cellsXY.y))
+			return;
+
+		// right, below left, below, below right
+		constexpr int32_t forward[4][2] = { { 1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 } };
+		std::vector<IdType>& ids = context.pairIds;
+
+		forEachOccupiedInRange({ 0, rowBegin }, { m_cellsXY.x - 1, std::min(rowEnd, m_cellsXY.y) - 1 }, [&](const uint32_t idx, const sf::Vector2<uint32_t> cell)
+		{
+			ids.clear();
+			m_cells[idx].forEach(m_overflow, [&ids](const IdType id) { ids.push_back(id); });
+
+			for (size_t i{0}; i < ids.size(); i++)
+			{
+				for (size_t j = i + 1; j < ids.size(); j++)
+					func(ids[i], ids[j]);
+			}
+
+			for (const auto& [dx, dy] : forward)
+			{
+				// past the edge of the grid this is a ghost cell, which is never occupied. x - 1 wraps around on the
+				// first column and lands on the ghost column before it
+				const sf::Vector2<uint32_t> neighbour = { cell.x + static_cast<uint32_t>(dx), cell.y + static_cast<uint32_t>(dy) };
+
+				const uint32_t neighbourIdx = idx2dTo1d(neighbour);
+				if (!isOccupied(neighbourIdx))
+					continue;
+
+				m_cells[neighbourIdx].forEach(m_overflow, [&](const IdType other)
+				{
+					for (const IdType id : ids)
+						func(id, other);
+				});
+			}
+		});
+	}
+
+	// calls func(id) for every atom stored in rows [rowBegin, rowEnd)
+	template<typename Func>
+	void forEachInRows(const uint32_t rowBegin, const uint32_t rowEnd, Func&& func) const
+	{
+		if (m_cellsXY.x == 0 || rowBegin >= std::min(rowEnd, m_cellsXY.y))
+			return;
+
+		forEachOccupiedInRange({ 0, rowBegin }, { m_cellsXY.x - 1, std::min(rowEnd, m_cellsXY.y) - 1 }, [&](const uint32_t idx, const sf::Vector2<uint32_t>)
+		{
+			m_cells[idx].forEach(m_overflow, func);
+		});
+	}
+
+	// find() for every position at once, into one flat buffer. the queries run in cell order so consecutive
+	// queries read the same cells, and queries sharing a cell only gather its 3x3 block once per pass
+	void findAll(const std::vector<sf::Vector2f>& positions, NeighbourLists& lists)
+	{
+		const auto queries = static_cast<uint32_t>(positions.size());
+		lists.offsets.assign(static_cast<size_t>(queries) + 1, 0);
+		if (queries == 0)
+		{
+			lists.ids.clear();
+			return;
+		}
+
+		sortQueriesByCell(positions);
+
+		uint32_t indices[9];
+
+		// count pass, every query in a cell gets the same amount of candidates
+		uint32_t lastKey = Pool::none;
+		uint32_t count = 0;
+		for (const uint32_t query : m_batchOrder)
+		{
+			if (m_batchKeys[query] != lastKey)
+			{
+				lastKey = m_batchKeys[query];
+				neighbourIndices(posTo2dIdx(positions[query]), indices);
+
+				count = 0;
+				for (const uint32_t idx : indices)
+				{
+					if (isOccupied(idx))
+						count += m_cells[idx].size(m_overflow);
+				}
+			}
+			lists.offsets[query + 1] = count;
+		}
+
+		// prefix sum in query order
+		for (uint32_t i{0}; i < queries; i++)
+			lists.offsets[i + 1] += lists.offsets[i];
+		lists.ids.resize(lists.offsets[queries]);
+
+		// scatter pass, the 3x3 block is gathered once per cell and copied for the other queries in it
+		lastKey = Pool::none;
+		uint32_t first = 0;
+		for (const uint32_t query : m_batchOrder)
+		{
+			IdType* out = lists.ids.data() + lists.offsets[query];
+
+			if (m_batchKeys[query] == lastKey)
+			{
+				std::copy_n(lists.ids.data() + first, lists.offsets[query + 1] - lists.offsets[query], out);
+				continue;
+			}
+
+			lastKey = m_batchKeys[query];
+			first = lists.offsets[query];
+			neighbourIndices(posTo2dIdx(positions[query]), indices);
+
+			for (const uint32_t idx : indices)
+			{
+				if (isOccupied(idx))
+					m_cells[idx].forEach(m_overflow, [&out](const IdType id) { *out++ = id; });
+			}
+		}
+
+		m_context.stats.queries += queries;
+		m_context.stats.candidates += lists.offsets[queries];
+	}
+
+	// counting sort of the queries by cell, m_batchOrder gets the query indices and m_batchKeys the cell of every query
+	void sortQueriesByCell(const std::vector<sf::Vector2f>& positions)
+	{
+		const auto queries = static_cast<uint32_t>(positions.size());
+		m_batchKeys.resize(queries);
+		m_batchOrder.resize(queries);
+		m_batchCellStart.assign(m_cells.size() + 1, 0);
+
+		for (uint32_t i{0}; i < queries; i++)
+		{
+			m_batchKeys[i] = cellKey(positions[i]);
+			m_batchCellStart[m_batchKeys[i] + 1]++;
+		}
+		for (size_t c{0}; c < m_cells.size(); c++)
+			m_batchCellStart[c + 1] += m_batchCellStart[c];
+		for (uint32_t i{0}; i < queries; i++)
+			m_batchOrder[m_batchCellStart[m_batchKeys[i]]++] = i;
+	}
+
+	// storage indices of the 3x3 block around cIdx, cells past the edge of the grid are ghost cells
+	void neighbourIndices(const sf::Vector2<uint32_t> cIdx, uint32_t (&indices)[9]) const
+	{
+		const sf::Vector2<uint32_t> stored = { cIdx.x + ghost_cells, cIdx.y + ghost_cells };
+
+		if constexpr (Layout == CellLayout::Morton)
+		{
+			// interleaved x and y bits don't overlap, so the 9 codes are just the 3 x codes or'ed with the 3 y codes
+			const uint32_t xs[3] = { spreadBits(stored.x - 1), spreadBits(stored.x), spreadBits(stored.x + 1) };
+			const uint32_t ys[3] = { spreadBits(stored.y - 1) << 1, spreadBits(stored.y) << 1, spreadBits(stored.y + 1) << 1 };
+
+			for (unsigned i{0}; i < 9; i++)
+				indices[i] = xs[i % 3] | ys[i / 3];
+		}
+		else
+		{
+			const uint32_t center = storageIndex(stored);
+			const int32_t* offsets = m_neighbourOffsets[Layout == CellLayout::Tiled ? (stored.x % tile_size) + (stored.y % tile_size) * tile_size : 0];
+
+			for (unsigned i{0}; i < 9; i++)
+				indices[i] = center + static_cast<uint32_t>(offsets[i]);
+		}
+	}
+
+	// ids within radius of position, filtered on the positions stored in the grid. radius can't be bigger than
+	// (1 - m_hysteresis) cells
+	Result& findWithin(const sf::Vector2f position, const float radius) requires StorePositions
+	{
+		return findWithin(position, radius, m_context);
+	}
+
+	Result& findWithin(const sf::Vector2f position, const float radius, QueryContext& context) const requires StorePositions
+	{
+		Result& found = context.found;
+		found.size = 0;
+		forEachWithin(position, radius, context, [&found](const IdType id, const sf::Vector2f) { found.add(id); });
+		return found;
+	}
+
+	// ids within radius of position, radius can be any size. cells the circle doesn't reach are skipped and cells
+	// completely inside it are taken without distance checks. positionOf(id) returns the position of an atom,
+	// grids that store positions use those instead
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findInRadius(const sf::Vector2f position, const float radius, PositionOf&& positionOf)
+	{
+		return findInRadius(position, radius, positionOf, m_context);
+	}
+
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findInRadius(const sf::Vector2f position, const float radius, PositionOf&& positionOf, QueryContext& context) const
+	{
+		Result& found = context.found;
+		found.size = 0;
+
+		sf::Vector2<uint32_t> minIdx, maxIdx;
+		if (!cellRange({ position.x - radius, position.y - radius }, { position.x + radius, position.y + radius }, minIdx, maxIdx))
+			return found;
+
+		const float radiusSquared = radius * radius;
+
+		forEachOccupiedInRange(minIdx, maxIdx, [&](const uint32_t idx, const sf::Vector2<uint32_t> cell)
+		{
+			const sf::Rect<float> bounds = cellBounds(cell);
+
+			// nearest and farthest point of the cell from the query position
+			const float nearX = std::clamp(position.x, bounds.left, bounds.left + bounds.width) - position.x;
+			const float nearY = std::clamp(position.y, bounds.top, bounds.top + bounds.height) - position.y;
+			if (nearX * nearX + nearY * nearY > radiusSquared)
+				return;
+
+			const float farX = std::max(std::abs(bounds.left - position.x), std::abs(bounds.left + bounds.width - position.x));
+			const float farY = std::max(std::abs(bounds.top - position.y), std::abs(bounds.top + bounds.height - position.y));
+			if (farX * farX + farY * farY <= radiusSquared)
+			{
+				m_cells[idx].forEach(m_overflow, [&found](const IdType id) { found.add(id); });
+				return;
+			}
+
+			forEachInCell(idx, positionOf, [&](const IdType id, const sf::Vector2f atomPos)
+			{
+				const float dx = atomPos.x - position.x;
+				const float dy = atomPos.y - position.y;
+				if (dx * dx + dy * dy <= radiusSquared)
+					found.add(id);
+			});
+		});
+
+		context.stats.queries++;
+		context.stats.candidates += found.size;
+		return found;
+	}
+
+	Result& findInRadius(const sf::Vector2f position, const float radius) requires StorePositions
+	{
+		return findInRadius(position, radius, m_context);
+	}
+
+	Result& findInRadius(const sf::Vector2f position, const float radius, QueryContext& context) const requires StorePositions
+	{
+		return findInRadius(position, radius, [](const IdType) { return sf::Vector2f{}; }, context);
+	}
+
+	// ids inside rect (same edges as sf::Rect::contains), for culling and selection. cells completely inside the
+	// rectangle are taken without checking positions, only the cells on its border are tested
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findInRect(const sf::Rect<float> rect, PositionOf&& positionOf)
+	{
+		return findInRect(rect, positionOf, m_context);
+	}
+
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findInRect(const sf::Rect<float> rect, PositionOf&& positionOf, QueryContext& context) const
+	{
+		Result& found = context.found;
+		found.size = 0;
+
+		// sf::Rect::contains takes negative sizes too, like a box selection dragged up and to the left
+		const sf::Vector2f minPos = { std::min(rect.left, rect.left + rect.width), std::min(rect.top, rect.top + rect.height) };
+		const sf::Vector2f maxPos = { std::max(rect.left, rect.left + rect.width), std::max(rect.top, rect.top + rect.height) };
+
+		sf::Vector2<uint32_t> minIdx, maxIdx;
+		if (!cellRange(minPos, maxPos, minIdx, maxIdx))
+			return found;
+
+		forEachOccupiedInRange(minIdx, maxIdx, [&](const uint32_t idx, const sf::Vector2<uint32_t> cell)
+		{
+			const sf::Rect<float> bounds = cellBounds(cell);
+
+			if (bounds.left >= minPos.x && bounds.top >= minPos.y &&
+				bounds.left + bounds.width < maxPos.x && bounds.top + bounds.height < maxPos.y)
+			{
+				m_cells[idx].forEach(m_overflow, [&found](const IdType id) { found.add(id); });
+				return;
+			}
+
+			forEachInCell(idx, positionOf, [&](const IdType id, const sf::Vector2f atomPos)
+			{
+				if (rect.contains(atomPos))
+					found.add(id);
+			});
+		});
+
+		context.stats.queries++;
+		context.stats.candidates += found.size;
+		return found;
+	}
+
+	Result& findInRect(const sf::Rect<float> rect) requires StorePositions
+	{
+		return findInRect(rect, m_context);
+	}
+
+	Result& findInRect(const sf::Rect<float> rect, QueryContext& context) const requires StorePositions
+	{
+		return findInRect(rect, [](const IdType) { return sf::Vector2f{}; }, context);
+	}
+
+	// the k atoms nearest to position, nearest first. the cells are searched ring by ring around the position until
+	// the next ring can't hold anything closer than the current k-th nearest
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findKNearest(const sf::Vector2f position, const uint32_t k, PositionOf&& positionOf)
+	{
+		return findKNearest(position, k, positionOf, m_context);
+	}
+
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	Result& findKNearest(const sf::Vector2f position, const uint32_t k, PositionOf&& positionOf, QueryContext& context) const
+	{
+		Result& found = context.found;
+		std::vector<std::pair<float, IdType>>& nearest = context.nearest;
+		found.size = 0;
+		nearest.clear();
+		if (k == 0 || m_cellsXY.x == 0 || m_cellsXY.y == 0)
+			return found;
+		nearest.reserve(k);
+
+		const auto lastX = static_cast<int32_t>(m_cellsXY.x - 1);
+		const auto lastY = static_cast<int32_t>(m_cellsXY.y - 1);
+		const sf::Vector2<int32_t> center = {
+			static_cast<int32_t>(std::clamp(std::floor(position.x * conversionFactor.x), 0.f, static_cast<float>(lastX))),
+			static_cast<int32_t>(std::clamp(std::floor(position.y * conversionFactor.y), 0.f, static_cast<float>(lastY))) };
+		const int32_t rings = std::max({ center.x, lastX - center.x, center.y, lastY - center.y });
+
+		uint32_t candidates = 0;
+		const auto visit = [&](const int32_t x, const int32_t y)
+		{
+			const uint32_t idx = idx2dTo1d({ static_cast<uint32_t>(x), static_cast<uint32_t>(y) });
+			if (!isOccupied(idx))
+				return;
+
+			forEachInCell(idx, positionOf, [&](const IdType id, const sf::Vector2f atomPos)
+			{
+				const float dx = atomPos.x - position.x;
+				const float dy = atomPos.y - position.y;
+				const float distanceSquared = dx * dx + dy * dy;
+				candidates++;
+
+				if (nearest.size() < k)
+				{
+					nearest.emplace_back(distanceSquared, id);
+					std::push_heap(nearest.begin(), nearest.end());
+				}
+				else if (distanceSquared < nearest.front().first)
+				{
+					std::pop_heap(nearest.begin(), nearest.end());
+					nearest.back() = { distanceSquared, id };
+					std::push_heap(nearest.begin(), nearest.end());
+				}
+			});
+		};
+
+		for (int32_t ring{0}; ring <= rings; ring++)
+		{
+			if (nearest.size() == k)
+			{
+				const float distance = ringDistance(position, center, ring);
+				if (distance * distance > nearest.front().first)
+					break;
+			}
+
+			const int32_t minX = center.x - ring, maxX = center.x + ring;
+			const int32_t minY = center.y - ring, maxY = center.y + ring;
+
+			// top and bottom row of the ring
+			for (int32_t x = std::max(minX, 0); x <= std::min(maxX, lastX); x++)
+			{
+				if (minY >= 0)
+					visit(x, minY);
+				if (ring > 0 && maxY <= lastY)
+					visit(x, maxY);
+			}
+
+			// left and right column, without the corners
+			for (int32_t y = std::max(minY + 1, 0); y <= std::min(maxY - 1, lastY); y++)
+			{
+				if (minX >= 0)
+					visit(minX, y);
+				if (ring > 0 && maxX <= lastX)
+					visit(maxX, y);
+			}
+		}
+
+		std::sort_heap(nearest.begin(), nearest.end());
+		for (const auto& [distanceSquared, id] : nearest)
+			found.add(id);
+
+		context.stats.queries++;
+		context.stats.candidates += candidates;
+		return found;
+	}
+
+	Result& findKNearest(const sf::Vector2f position, const uint32_t k) requires StorePositions
+	{
+		return findKNearest(position, k, m_context);
+	}
+
+	Result& findKNearest(const sf::Vector2f position, const uint32_t k, QueryContext& context) const requires StorePositions
+	{
+		return findKNearest(position, k, [](const IdType) { return sf::Vector2f{}; }, context);
+	}
+
+	// findKNearest() for every position, results go into one flat buffer in query order. the queries run in cell
+	// order like findAll(), so consecutive queries read the same cells
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	void findKNearest(const std::vector<sf::Vector2f>& positions, const uint32_t k, PositionOf&& positionOf, NeighbourLists& lists)
+	{
+		const auto queries = static_cast<uint32_t>(positions.size());
+		lists.offsets.assign(static_cast<size_t>(queries) + 1, 0);
+		lists.ids.clear();
+		if (queries == 0)
+			return;
+
+		sortQueriesByCell(positions);
+
+		// the keys aren't needed after the sort, they now hold where the result of each query starts in m_batchIds
+		m_batchIds.clear();
+		for (const uint32_t query : m_batchOrder)
+		{
+			const Result& nearest = findKNearest(positions[query], k, positionOf);
+
+			m_batchKeys[query] = static_cast<uint32_t>(m_batchIds.size());
+			lists.offsets[query + 1] = nearest.size;
+			m_batchIds.insert(m_batchIds.end(), nearest.array.begin(), nearest.array.begin() + nearest.size);
+		}
+
+		for (uint32_t i{0}; i < queries; i++)
+			lists.offsets[i + 1] += lists.offsets[i];
+		lists.ids.resize(lists.offsets[queries]);
+
+		for (uint32_t i{0}; i < queries; i++)
+			std::copy_n(m_batchIds.data() + m_batchKeys[i], lists.offsets[i + 1] - lists.offsets[i], lists.ids.data() + lists.offsets[i]);
+	}
+
+	void findKNearest(const std::vector<sf::Vector2f>& positions, const uint32_t k, NeighbourLists& lists) requires StorePositions
+	{
+		findKNearest(positions, k, [](const IdType) { return sf::Vector2f{}; }, lists);
+	}
+
+	// atoms whose circle of the given radius is crossed by the segment from start to end, in the order the segment
+	// enters them. the cells under the segment are walked with a DDA (Amanatides & Woo) and the 3x3 block around
+	// each one is tested. a hit is reported once the walk has left every cell an earlier hit could come from, so the
+	// walk stops as soon as maxHits hits are known. radius can't be bigger than (1 - m_hysteresis) cells, atoms can
+	// be up to m_hysteresis outside the cell they are stored in
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	RayHits& raycast(const sf::Vector2f start, const sf::Vector2f end, const float radius, PositionOf&& positionOf,
+		const uint32_t maxHits = std::numeric_limits<uint32_t>::max())
+	{
+		return raycast(start, end, radius, positionOf, m_context, maxHits);
+	}
+
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	RayHits& raycast(const sf::Vector2f start, const sf::Vector2f end, const float radius, PositionOf&& positionOf,
+		QueryContext& context, const uint32_t maxHits = std::numeric_limits<uint32_t>::max()) const
+	{
+		RayHits& hits = context.rayHits;
+		std::vector<RayHit>& pending = context.rayPending;
+		std::vector<uint32_t>& stamps = context.rayStamps;
+		hits.size = 0;
+		pending.clear();
+		if (maxHits == 0 || m_cellsXY.x == 0 || m_cellsXY.y == 0)
+			return hits;
+
+		if (++context.rayStamp == 0)
+		{
+			std::fill(stamps.begin(), stamps.end(), 0);
+			context.rayStamp = 1;
+		}
+		if (stamps.size() < m_handles.size())
+			stamps.resize(m_handles.size(), 0);
+
+		const sf::Vector2f delta = end - start;
+		const float length = std::sqrt(delta.x * delta.x + delta.y * delta.y);
+		const sf::Vector2f direction = length > 0.f ? delta / length : sf::Vector2f{ 1.f, 0.f };
+
+		// clip the segment to the grid plus one cell on every side, circles in the edge cells reach out of the grid
+		float tEnter = 0.f;
+		float tLeave = length;
+		const auto clip = [&](const float origin, const float dir, const float cellSize, const uint32_t cells)
+		{
+			const float low = -cellSize;
+			const float high = static_cast<float>(cells + 1) * cellSize;
+			if (dir == 0.f)
+			{
+				if (origin < low || origin > high)
+					tEnter = std::numeric_limits<float>::max();
+				return;
+			}
+
+			const float t0 = (low - origin) / dir;
+			const float t1 = (high - origin) / dir;
+			tEnter = std::max(tEnter, std::min(t0, t1));
+			tLeave = std::min(tLeave, std::max(t0, t1));
+		};
+		clip(start.x, direction.x, m_cellDimensions.x, m_cellsXY.x);
+		clip(start.y, direction.y, m_cellDimensions.y, m_cellsXY.y);
+		if (tEnter > tLeave)
+			return hits;
+
+		const auto lastX = static_cast<int32_t>(m_cellsXY.x - 1);
+		const auto lastY = static_cast<int32_t>(m_cellsXY.y - 1);
+		sf::Vector2<int32_t> cell = {
+			static_cast<int32_t>(std::clamp(std::floor((start.x + direction.x * tEnter) * conversionFactor.x), -1.f, static_cast<float>(lastX + 1))),
+			static_cast<int32_t>(std::clamp(std::floor((start.y + direction.y * tEnter) * conversionFactor.y), -1.f, static_cast<float>(lastY + 1))) };
+
+		// distance along the ray to the next vertical / horizontal cell border, and between two of them
+		constexpr float never = std::numeric_limits<float>::infinity();
+		const sf::Vector2<int32_t> step = { direction.x > 0.f ? 1 : -1, direction.y > 0.f ? 1 : -1 };
+		const sf::Vector2f tDelta = {
+			direction.x != 0.f ? m_cellDimensions.x / std::abs(direction.x) : never,
+			direction.y != 0.f ? m_cellDimensions.y / std::abs(direction.y) : never };
+		sf::Vector2f tMax = {
+			direction.x != 0.f ? (static_cast<float>(cell.x + (step.x > 0)) * m_cellDimensions.x - start.x) / direction.x : never,
+			direction.y != 0.f ? (static_cast<float>(cell.y + (step.y > 0)) * m_cellDimensions.y - start.y) / direction.y : never };
+
+		const float radiusSquared = radius * radius;
+		const auto nearer = [](const RayHit& a, const RayHit& b) { return a.distance > b.distance; };
+
+		while (true)
+		{
+			for (int32_t y = std::max(cell.y - 1, 0); y <= std::min(cell.y + 1, lastY); y++)
+			{
+				for (int32_t x = std::max(cell.x - 1, 0); x <= std::min(cell.x + 1, lastX); x++)
+				{
+					const uint32_t idx = idx2dTo1d({ static_cast<uint32_t>(x), static_cast<uint32_t>(y) });
+					if (!isOccupied(idx))
+						continue;
+
+					forEachInCell(idx, positionOf, [&](const IdType id, const sf::Vector2f atomPos)
+					{
+						uint32_t& stamp = stamps[static_cast<size_t>(id)];
+						if (stamp == context.rayStamp)
+							return;
+						stamp = context.rayStamp;
+
+						float distance;
+						if (rayEntersCircle(start, direction, length, atomPos, radiusSquared, distance))
+						{
+							pending.push_back({ id, distance });
+							std::push_heap(pending.begin(), pending.end(), nearer);
+						}
+					});
+				}
+			}
+
+			// every circle the ray enters before leaving this cell has been tested by now
+			const float tExit = std::min({ tMax.x, tMax.y, tLeave });
+			while (!pending.empty() && pending.front().distance <= tExit)
+			{
+				std::pop_heap(pending.begin(), pending.end(), nearer);
+				hits.add(pending.back());
+				pending.pop_back();
+
+				if (hits.size == maxHits)
+					return hits;
+			}
+
+			if (tExit >= tLeave)
+				break;
+
+			if (tMax.x < tMax.y)
+			{
+				cell.x += step.x;
+				tMax.x += tDelta.x;
+			}
+			else
+			{
+				cell.y += step.y;
+				tMax.y += tDelta.y;
+			}
+
+			if (cell.x < -1 || cell.y < -1 || cell.x > lastX + 1 || cell.y > lastY + 1)
+				break;
+		}
+
+		// only reachable through rounding at the end of the walk
+		while (!pending.empty() && hits.size < maxHits)
+		{
+			std::pop_heap(pending.begin(), pending.end(), nearer);
+			hits.add(pending.back());
+			pending.pop_back();
+		}
+
+		return hits;
+	}
+
+	RayHits& raycast(const sf::Vector2f start, const sf::Vector2f end, const float radius,
+		const uint32_t maxHits = std::numeric_limits<uint32_t>::max()) requires StorePositions
+	{
+		return raycast(start, end, radius, m_context, maxHits);
+	}
+
+	RayHits& raycast(const sf::Vector2f start, const sf::Vector2f end, const float radius, QueryContext& context,
+		const uint32_t maxHits = std::numeric_limits<uint32_t>::max()) const requires StorePositions
+	{
+		return raycast(start, end, radius, [](const IdType) { return sf::Vector2f{}; }, context, maxHits);
+	}
+
+	// raycast() for every ray, the hits go into one flat buffer. maxHits = 1 gives line of sight / first hit tests
+	template<typename PositionOf> requires std::is_invocable_r_v<sf::Vector2f, PositionOf&, IdType>
+	void raycast(const std::vector<Ray>& rays, const float radius, PositionOf&& positionOf, RayHitLists& lists,
+		const uint32_t maxHits = std::numeric_limits<uint32_t>::max())
+	{
+		lists.offsets.resize(rays.size() + 1);
+		lists.hits.clear();
+
+		for (size_t i{0}; i < rays.size(); i++)
+		{
+			lists.offsets[i] = static_cast<uint32_t>(lists.hits.size());
+
+			const RayHits& hits = raycast(rays[i].start, rays[i].end, radius, positionOf, maxHits);
+			lists.hits.insert(lists.hits.end(), hits.array.begin(), hits.array.begin() + hits.size);
+		}
+		lists.offsets[rays.size()] = static_cast<uint32_t>(lists.hits.size());
+	}
+
+	void raycast(const std::vector<Ray>& rays, const float radius, RayHitLists& lists,
+		const uint32_t maxHits = std::numeric_limits<uint32_t>::max()) requires StorePositions
+	{
+		raycast(rays, radius, [](const IdType) { return sf::Vector2f{}; }, lists, maxHits);
+	}
+
+	// distance along the ray to where it enters the circle, false when the segment misses it. a ray starting inside
+	// the circle hits it at 0
+	[[nodiscard]] static bool rayEntersCircle(const sf::Vector2f start, const sf::Vector2f direction, const float length,
+		const sf::Vector2f center, const float radiusSquared, float& distance)
+	{
+		const float mx = start.x - center.x;
+		const float my = start.y - center.y;
+		const float b = mx * direction.x + my * direction.y;
+		const float c = mx * mx + my * my - radiusSquared;
+
+		if (c <= 0.f)
+		{
+			distance = 0.f;
+			return true;
+		}
+		if (b > 0.f)
+			return false;
+
+		const float discriminant = b * b - c;
+		if (discriminant < 0.f)
+			return false;
+
+		distance = -b - std::sqrt(discriminant);
+		return distance <= length;
+	}
+
+	// lower bound on the distance from position to any atom stored in the ring of cells around center. sides of
+	// the ring that are outside the grid hold no cells and are left out
+	[[nodiscard]] float ringDistance(const sf::Vector2f position, const sf::Vector2<int32_t> center, const int32_t ring) const
+	{
+		if (ring == 0)
+			return 0.f;
+
+		float distance = std::numeric_limits<float>::max();
+		if (center.x - ring >= 0)
+			distance = std::min(distance, position.x - (static_cast<float>(center.x - ring + 1) + m_hysteresis) * m_cellDimensions.x);
+		if (center.x + ring < static_cast<int32_t>(m_cellsXY.x))
+			distance = std::min(distance, (static_cast<float>(center.x + ring) - m_hysteresis) * m_cellDimensions.x - position.x);
+		if (center.y - ring >= 0)
+			distance = std::min(distance, position.y - (static_cast<float>(center.y - ring + 1) + m_hysteresis) * m_cellDimensions.y);
+		if (center.y + ring < static_cast<int32_t>(m_cellsXY.y))
+			distance = std::min(distance, (static_cast<float>(center.y + ring) - m_hysteresis) * m_cellDimensions.y - position.y);
+
+		return std::max(distance, 0.f);
+	}
+
+	// calls func(id, position) for every atom in the cell, with the stored position or the one from positionOf
+	template<typename PositionOf, typename Func>
+	void forEachInCell(const uint32_t idx, PositionOf& positionOf, Func&& func) const
+	{
+		if constexpr (StorePositions)
+			m_cells[idx].forEachWithPosition(m_overflow, func);
+		else
+			m_cells[idx].forEach(m_overflow, [&](const IdType id) { func(id, positionOf(id)); });
+	}
+
+	// cells that can hold atoms inside the area from minPos to maxPos, clamped to the grid. false when the area misses the grid
+	bool cellRange(const sf::Vector2f minPos, const sf::Vector2f maxPos, sf::Vector2<uint32_t>& minIdx, sf::Vector2<uint32_t>& maxIdx) const
+	{
+		const float minX = std::floor(minPos.x * conversionFactor.x - m_hysteresis);
+		const float minY = std::floor(minPos.y * conversionFactor.y - m_hysteresis);
+		const float maxX = std::floor(maxPos.x * conversionFactor.x + m_hysteresis);
+		const float maxY = std::floor(maxPos.y * conversionFactor.y + m_hysteresis);
+
+		if (maxX < 0.f || maxY < 0.f || minX >= static_cast<float>(m_cellsXY.x) || minY >= static_cast<float>(m_cellsXY.y))
+			return false;
+
+		minIdx = { static_cast<uint32_t>(std::max(minX, 0.f)), static_cast<uint32_t>(std::max(minY, 0.f)) };
+		maxIdx = {
+			static_cast<uint32_t>(std::min(maxX, static_cast<float>(m_cellsXY.x - 1))),
+			static_cast<uint32_t>(std::min(maxY, static_cast<float>(m_cellsXY.y - 1))) };
+		return true;
+	}
+
+	// area an atom stored in the cell can be in, wider than the cell itself when atoms are allowed to linger
+	[[nodiscard]] sf::Rect<float> cellBounds(const sf::Vector2<uint32_t> cell) const
+	{
+		return {
+			(static_cast<float>(cell.x) - m_hysteresis) * m_cellDimensions.x,
+			(static_cast<float>(cell.y) - m_hysteresis) * m_cellDimensions.y,
+			(1.f + 2.f * m_hysteresis) * m_cellDimensions.x,
+			(1.f + 2.f * m_hysteresis) * m_cellDimensions.y };
+	}
+
+	void insert(const sf::Vector2<uint32_t> cIdx, const IdType atom, const sf::Vector2f pos)
+	{
+		const uint32_t idx = idx2dTo1d(cIdx);
+
+		// first atom in these 64 cells since the last clear(), whatever is left in them is from an old epoch
+		OccupancyWord& word = m_occupied[idx / 64];
+		if (word.epoch != m_epoch)
+		{
+			resetWord(idx / 64);
+			word.epoch = m_epoch;
+		}
+		word.bits |= uint64_t{1} << (idx % 64);
+
+		const uint32_t slot = m_cells[idx].addAtom(atom, m_overflow, pos);
+
+		const auto index = static_cast<size_t>(atom);
+		if (index >= m_handles.size())
+			m_handles.resize(index + 1);
+		m_handles[index] = { cIdx, slot };
+	}
+
+	void resetWord(const uint32_t word)
+	{
+		m_occupied[word].bits = 0;
+
+		const auto end = std::min<size_t>(static_cast<size_t>(word) * 64 + 64, m_cells.size());
+		for (size_t idx = static_cast<size_t>(word) * 64; idx < end; idx++)
+			m_cells[idx].clear();
+	}
+
+	// makes the word current from any thread. the thread that takes it over from an older epoch empties it, the
+	// others wait on resetting_epoch until it's done
+	void acquireWordConcurrent(const uint32_t word)
+	{
+		std::atomic_ref<uint32_t> epoch(m_occupied[word].epoch);
+		uint32_t seen = epoch.load(std::memory_order_acquire);
+
+		while (seen != m_epoch)
+		{
+			if (seen != resetting_epoch && epoch.compare_exchange_weak(seen, resetting_epoch, std::memory_order_acquire))
+			{
+				resetWord(word);
+				epoch.store(m_epoch, std::memory_order_release);
+				return;
+			}
+			seen = epoch.load(std::memory_order_acquire);
+		}
+	}
+
+	[[nodiscard]] uint32_t idx2dTo1d(const sf::Vector2<uint32_t> idx) const
+	{
+		return storageIndex({ idx.x + ghost_cells, idx.y + ghost_cells });
+	}
+
+	// index of storage coordinates, ghost cells included
+	[[nodiscard]] uint32_t storageIndex(const sf::Vector2<uint32_t> stored) const
+	{
+		if constexpr (Layout == CellLayout::Morton)
+			return spreadBits(stored.x) | spreadBits(stored.y) << 1;
+
+		else if constexpr (Layout == CellLayout::Tiled)
+		{
+			const uint32_t tile = (stored.x / tile_size) + (stored.y / tile_size) * m_tilesX;
+			return tile * tile_size * tile_size + (stored.x % tile_size) + (stored.y % tile_size) * tile_size;
+		}
+
+		else
+			return stored.x + stored.y * (m_cellsXY.x + 2 * ghost_cells);
+	}
+
+	// storage position of the cell holding pos, sorting atoms by it puts them in the same order as the cells
+	[[nodiscard]] uint32_t cellKey(const sf::Vector2f pos) const
+	{
+		return idx2dTo1d(posTo2dIdx(pos));
+	}
+
+	[[nodiscard]] uint32_t storageSize() const
+	{
+		const uint32_t storedX = m_cellsXY.x + 2 * ghost_cells;
+		const uint32_t storedY = m_cellsXY.y + 2 * ghost_cells;
+
+		if constexpr (Layout == CellLayout::Morton)
+		{
+			uint32_t side = 1;
+			while (side < storedX || side < storedY)
+				side *= 2;
+			return side * side;
+		}
+
+		else if constexpr (Layout == CellLayout::Tiled)
+			return m_tilesX * ((storedY + tile_size - 1) / tile_size) * tile_size * tile_size;
+
+		else
+			return storedX * storedY;
+	}
+
+	// puts a zero bit in front of each of the low 16 bits: 0b1011 -> 0b01000101
+	[[nodiscard]] static uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0x0000FFFF;
+		value = (value | (value << 8)) & 0x00FF00FF;
+		value = (value | (value << 4)) & 0x0F0F0F0F;
+		value = (value | (value << 2)) & 0x33333333;
+		value = (value | (value << 1)) & 0x55555555;
+		return value;
+	}
+
+	void initNeighbourOffsets()
+	{
+		// a tile sized window is enough to see every position relative to the tile borders
+		const uint32_t positions = Layout == CellLayout::Tiled ? tile_size * tile_size : 1;
+
+		for (uint32_t p{0}; p < positions; p++)
+		{
+			// the window is placed one tile in, so the block around it never needs a negative coordinate
+			const sf::Vector2<uint32_t> center = { tile_size + p % tile_size, tile_size + p / tile_size };
+			const auto centerIdx = static_cast<int64_t>(storageIndex(center));
+
+			for (unsigned i{0}; i < 9; i++)
+			{
+				const sf::Vector2<uint32_t> neighbour = { center.x + i % 3 - 1, center.y + i / 3 - 1 };
+				m_neighbourOffsets[p][i] = static_cast<int32_t>(static_cast<int64_t>(storageIndex(neighbour)) - centerIdx);
+			}
+		}
+	}
+
+	// cell holding position. query positions outside the grid are clamped to the nearest edge cell with min / max
+	// instead of a bounds check, so there is no branch
+	[[nodiscard]] sf::Vector2<uint32_t> posTo2dIdx(const sf::Vector2f position) const
+	{
+		return {
+			static_cast<uint32_t>(std::min(std::max(position.x * conversionFactor.x, 0.f), m_lastCell.x)),
+			static_cast<uint32_t>(std::min(std::max(position.y * conversionFactor.y, 0.f), m_lastCell.y))};
+	}
+
+	// atoms have to be inside the grid, the range queries only look at the cells an area overlaps
+	[[nodiscard]] bool insideGrid(const sf::Vector2f position) const
+	{
+		const float x = position.x * conversionFactor.x;
+		const float y = position.y * conversionFactor.y;
+		return x >= 0.f && y >= 0.f && x < static_cast<float>(m_cellsXY.x) && y < static_cast<float>(m_cellsXY.y);
+	}
+
+
+	void initVertexBuffer()
+	{
+		std::vector<sf::Vertex> vertices(static_cast<std::vector<sf::Vertex>::size_type>((m_cellsXY.x + m_cellsXY.y) * 2));
+
+		m_renderGrid = sf::VertexBuffer(sf::Lines, sf::VertexBuffer::Static);
+		m_renderGrid.create(vertices.size());
+
+		size_t counter = 0;
+		for (unsigned i = 0; i < m_cellsXY.x; i++)
+		{
+			const float posX = static_cast<float>(i) * m_cellDimensions.x;
+			vertices[counter].position = { posX, 0 };
+			vertices[counter + 1].position = { m_screenSize.left + posX, m_screenSize.top + m_screenSize.height };
+			counter += 2;
+		}
+
+		for (unsigned i = 0; i < m_cellsXY.y; i++)
+		{
+			const float posY = static_cast<float>(i) * m_cellDimensions.y;
+			vertices[counter].position = { 0, posY };
+			vertices[counter + 1].position = { m_screenSize.left + m_screenSize.width, m_screenSize.top + posY };
+			counter += 2;
+		}
+
+		m_renderGrid.update(vertices.data(), vertices.size(), 0);
+	}
+
+
+	void reSize(const sf::Rect<float> screenSize)
+	{
+		init(screenSize, m_cellsXY);
+	}
+};
+
+
+using SpatialHashGrid = BasicSpatialHashGrid<>;
+
+// 16 bit ids and 8 inline slots, a cell is 24 bytes instead of 88
+using SmallSpatialHashGrid = BasicSpatialHashGrid<uint16_t, 8>;
+
+// 64 inline slots for very crowded simulations
+using DenseSpatialHashGrid = BasicSpatialHashGrid<uint32_t, 64>;
+
+// keeps positions in the cells, for findWithin()
+using PositionedSpatialHashGrid = BasicSpatialHashGrid<int32_t, 20, uint8_t, CellLayout::RowMajor, true>;
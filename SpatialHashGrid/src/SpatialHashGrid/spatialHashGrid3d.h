@@ -0,0 +1,163 @@
+#pragma once
+
+#include <SFML/System/Vector3.hpp>
+#include <vector>
+
+#include <algorithm>
+#include <cstdint>
+#include <stdexcept>
+
+#include "spatialHashGrid.h"
+/*
+	SpatialHashGrid3d
+
+	3D sibling of SpatialHashGrid for volumetric particle simulations, uses the
+	same CollisionCell / overflow pool storage and c_Vec results. find() returns
+	the 27 cells around the position.
+
+	Cells are grouped into 4x4x4 bricks. Bricks are stored one after another in
+	row major order and the 64 cells inside a brick are stored in morton (z curve)
+	order, so most of a 3x3x3 neighbourhood lives inside one or two bricks instead
+	of being spread over 9 rows of 3 different slices. The grid is padded up to a
+	multiple of 4 cells on every axis.
+*/
+
+
+template<typename IdType = int32_t, uint16_t CellCapacity = 20, typename CountType = uint8_t>
+struct BasicSpatialHashGrid3d
+{
+	using Cell = CollisionCell<IdType, CellCapacity, CountType>;
+	using Pool = typename Cell::Pool;
+	using Result = c_Vec<IdType, CellCapacity * 27>;
+
+	static constexpr uint32_t brick_size = 4;
+	static constexpr uint32_t brick_cells = brick_size * brick_size * brick_size;
+
+	std::vector<Cell> m_cells{};
+	Pool m_overflow{};
+	sf::Vector3<uint32_t> m_cellsXYZ{};
+	sf::Vector3<uint32_t> m_bricksXYZ{};
+
+	sf::Vector3f conversionFactor{};
+	Result found{};
+
+	sf::Vector3f m_cellDimensions{};
+	sf::Vector3f m_worldSize{};
+
+	// constructor and destructor
+	explicit BasicSpatialHashGrid3d(const sf::Vector3f worldSize = {}, const sf::Vector3<uint32_t> cellsXYZ = {})
+	{
+		init(worldSize, cellsXYZ);
+	}
+	~BasicSpatialHashGrid3d() = default;
+
+
+	void init(const sf::Vector3f worldSize, const sf::Vector3<uint32_t> cellsXYZ)
+	{
+		m_cellsXYZ = cellsXYZ;
+		m_worldSize = worldSize;
+
+		m_bricksXYZ = {
+			(m_cellsXYZ.x + brick_size - 1) / brick_size,
+			(m_cellsXYZ.y + brick_size - 1) / brick_size,
+			(m_cellsXYZ.z + brick_size - 1) / brick_size };
+
+		m_cells.resize(static_cast<size_t>(m_bricksXYZ.x) * m_bricksXYZ.y * m_bricksXYZ.z * brick_cells);
+		clear();
+
+		m_cellDimensions = {
+			m_worldSize.x / static_cast<float>(m_cellsXYZ.x),
+			m_worldSize.y / static_cast<float>(m_cellsXYZ.y),
+			m_worldSize.z / static_cast<float>(m_cellsXYZ.z) };
+
+		conversionFactor = { 1.f / m_cellDimensions.x, 1.f / m_cellDimensions.y, 1.f / m_cellDimensions.z };
+	}
+
+
+	// other functions
+	void addAtom(const sf::Vector3f pos, const IdType atom)
+	{
+		if (!insideGrid(pos))
+			throw std::out_of_range("addAtom() position argument out of range");
+
+		m_cells[idx3dTo1d(posTo3dIdx(pos))].addAtom(atom, m_overflow);
+	}
+
+	void clear()
+	{
+		for (Cell& cell : m_cells) {
+			cell.clear();
+		}
+		m_overflow.clear();
+	}
+
+	Result& find(const sf::Vector3f position)
+	{
+		found.size = 0;
+
+		if (!insideGrid(position))
+			throw std::out_of_range("find() position argument out of range");
+
+		const sf::Vector3<uint32_t> cIdx = posTo3dIdx(position);
+
+		const sf::Vector3<uint32_t> minIdx = { cIdx.x > 0 ? cIdx.x - 1 : 0, cIdx.y > 0 ? cIdx.y - 1 : 0, cIdx.z > 0 ? cIdx.z - 1 : 0 };
+		const sf::Vector3<uint32_t> maxIdx = {
+			std::min(cIdx.x + 1, m_cellsXYZ.x - 1),
+			std::min(cIdx.y + 1, m_cellsXYZ.y - 1),
+			std::min(cIdx.z + 1, m_cellsXYZ.z - 1) };
+
+		for (unsigned z = minIdx.z; z <= maxIdx.z; z++)
+		{
+			for (unsigned y = minIdx.y; y <= maxIdx.y; y++)
+			{
+				for (unsigned x = minIdx.x; x <= maxIdx.x; x++)
+				{
+					m_cells[idx3dTo1d({ x, y, z })].forEach(m_overflow, [this](const IdType id) { found.add(id); });
+				}
+			}
+		}
+
+		return found;
+	}
+
+	[[nodiscard]] uint32_t idx3dTo1d(const sf::Vector3<uint32_t> idx) const
+	{
+		const uint32_t brick = (idx.x / brick_size) + m_bricksXYZ.x * ((idx.y / brick_size) + m_bricksXYZ.y * (idx.z / brick_size));
+		return brick * brick_cells + morton3(idx.x % brick_size, idx.y % brick_size, idx.z % brick_size);
+	}
+
+	[[nodiscard]] sf::Vector3<uint32_t> posTo3dIdx(const sf::Vector3f position) const
+	{
+		return {
+			static_cast<uint32_t>(position.x * conversionFactor.x),
+			static_cast<uint32_t>(position.y * conversionFactor.y),
+			static_cast<uint32_t>(position.z * conversionFactor.z) };
+	}
+
+	// checked on the float position, casting a negative one to uint32_t is undefined
+	[[nodiscard]] bool insideGrid(const sf::Vector3f position) const
+	{
+		const float x = position.x * conversionFactor.x;
+		const float y = position.y * conversionFactor.y;
+		const float z = position.z * conversionFactor.z;
+		return x >= 0.f && y >= 0.f && z >= 0.f &&
+			x < static_cast<float>(m_cellsXYZ.x) && y < static_cast<float>(m_cellsXYZ.y) && z < static_cast<float>(m_cellsXYZ.z);
+	}
+
+
+	void reSize(const sf::Vector3f worldSize)
+	{
+		init(worldSize, m_cellsXYZ);
+	}
+
+
+private:
+	// interleaves the two low bits of x, y and z: ...z1 y1 x1 z0 y0 x0
+	[[nodiscard]] static uint32_t morton3(const uint32_t x, const uint32_t y, const uint32_t z)
+	{
+		return (x & 1) | (y & 1) << 1 | (z & 1) << 2 | (x & 2) << 2 | (y & 2) << 3 | (z & 2) << 4;
+	}
+};
+
+
+using SpatialHashGrid3d = BasicSpatialHashGrid3d<>;
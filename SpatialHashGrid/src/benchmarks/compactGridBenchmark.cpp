@@ -0,0 +1,96 @@
+/*
+    Times CompactSpatialHashGrid::build() against buildParallel() on 1, 2, 4 .. 32
+    workers for 1M atoms and prints the speedup of every worker count. Every parallel
+    table is compared with the serial one and the program fails when they differ.
+
+    usage: compactGridBenchmark [atoms] [max workers]
+    worker counts above std::thread::hardware_concurrency() share the cores, so the
+    scaling flattens out past the core count of the machine
+
+    standalone program, it is not part of the Visual Studio project:
+    g++ -std=c++20 -O2 -pthread -I../../../External/include compactGridBenchmark.cpp
+*/
+
+#include <iostream>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include "../SpatialHashGrid/compactGrid.h"
+
+
+// best wall time of runs calls of func, in milliseconds
+template<typename Func>
+double bestOfMs(const unsigned runs, Func&& func)
+{
+	double best = std::numeric_limits<double>::max();
+	for (unsigned run{0}; run < runs; run++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+		best = std::min(best, time.count());
+	}
+	return best;
+}
+
+
+int main(const int argc, char** argv)
+{
+	const uint32_t atoms = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1'000'000;
+	const uint32_t maxWorkers = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) : 32;
+	const sf::Rect<float> screen = { 0.f, 0.f, 1920.f, 1080.f };
+	const sf::Vector2u cells = { 1024, 576 };
+	constexpr unsigned runs = 5;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> x(0.f, std::nextafter(screen.width, 0.f));
+	std::uniform_real_distribution<float> y(0.f, std::nextafter(screen.height, 0.f));
+
+	CompactSpatialHashGrid serial(screen, cells);
+	CompactSpatialHashGrid parallel(screen, cells);
+	serial.reserve(atoms);
+	parallel.reserve(atoms);
+
+	for (uint32_t i{0}; i < atoms; i++)
+	{
+		const sf::Vector2f position = { x(rng), y(rng) };
+		serial.addAtom(position, static_cast<int32_t>(i));
+		parallel.addAtom(position, static_cast<int32_t>(i));
+	}
+
+	// the atoms stay added, only the table is built again
+	const double serialMs = bestOfMs(runs, [&]
+	{
+		serial.m_built = false;
+		serial.build();
+	});
+
+	std::cout << "atoms " << atoms << ", cells " << cells.x << "x" << cells.y << ", hardware threads " << std::thread::hardware_concurrency() << "\n";
+	std::cout << "build()           " << serialMs << " ms\n";
+
+	bool matches = true;
+	for (uint32_t workers = 1; workers <= maxWorkers; workers *= 2)
+	{
+		RowBandScheduler scheduler(workers);
+
+		const double parallelMs = bestOfMs(runs, [&]
+		{
+			parallel.m_built = false;
+			parallel.buildParallel(scheduler);
+		});
+
+		const bool same = parallel.m_cellStart == serial.m_cellStart && parallel.m_objects == serial.m_objects;
+		matches = matches && same;
+
+		std::cout << "buildParallel(" << workers << ")" << std::string(workers < 10 ? 4 : 3, ' ')
+			<< parallelMs << " ms, speedup " << serialMs / parallelMs << (same ? "" : ", TABLE DIFFERS FROM build()") << "\n";
+	}
+
+	return matches ? 0 : 1;
+}
@@ -0,0 +1,83 @@
+/*
+    Fills and queries a SpatialHashGrid3d with 1M uniformly spread points and
+    prints the time per insert and per find(), to size hardware for volumetric runs.
+
+    usage: grid3dBenchmark [points] [cells per axis]
+    the cells default to about 2 points per cell
+
+    standalone program, it is not part of the Visual Studio project:
+    g++ -std=c++20 -O2 -I../../../External/include grid3dBenchmark.cpp -lsfml-graphics -lsfml-window -lsfml-system
+*/
+
+#include <iostream>
+
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <string>
+#include "../SpatialHashGrid/spatialHashGrid3d.h"
+
+
+// best wall time of runs calls of func, in milliseconds
+template<typename Func>
+double bestOfMs(const unsigned runs, Func&& func)
+{
+	double best = std::numeric_limits<double>::max();
+	for (unsigned run{0}; run < runs; run++)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		func();
+		const std::chrono::duration<double, std::milli> time = std::chrono::steady_clock::now() - start;
+		best = std::min(best, time.count());
+	}
+	return best;
+}
+
+
+int main(const int argc, char** argv)
+{
+	const uint32_t points = argc > 1 ? static_cast<uint32_t>(std::stoul(argv[1])) : 1'000'000;
+	const uint32_t cellsPerAxis = argc > 2 ? static_cast<uint32_t>(std::stoul(argv[2])) :
+		std::max(static_cast<uint32_t>(std::cbrt(points / 2.0)), 1u);
+	constexpr float world_size = 1000.f;
+	constexpr unsigned runs = 5;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> coordinate(0.f, std::nextafter(world_size, 0.f));
+	std::vector<sf::Vector3f> positions(points);
+	for (sf::Vector3f& position : positions)
+		position = { coordinate(rng), coordinate(rng), coordinate(rng) };
+
+	SpatialHashGrid3d grid({ world_size, world_size, world_size }, { cellsPerAxis, cellsPerAxis, cellsPerAxis });
+
+	const double fillMs = bestOfMs(runs, [&]
+	{
+		grid.clear();
+		for (uint32_t i{0}; i < points; i++)
+			grid.addAtom(positions[i], static_cast<int32_t>(i));
+	});
+
+	// the sum keeps the queries from being optimised away and doubles as a check between runs
+	uint64_t candidates = 0;
+	const double findMs = bestOfMs(runs, [&]
+	{
+		candidates = 0;
+		for (const sf::Vector3f& position : positions)
+			candidates += grid.find(position).size;
+	});
+
+	const double cellMb = static_cast<double>(grid.m_cells.size() * sizeof(SpatialHashGrid3d::Cell)) / (1024.0 * 1024.0);
+	const double overflowMb = static_cast<double>(grid.m_overflow.m_chunks.size() * sizeof(SpatialHashGrid3d::Pool::Chunk)) / (1024.0 * 1024.0);
+
+	std::cout << "points            " << points << "\n";
+	std::cout << "cells             " << cellsPerAxis << "^3 (" << grid.m_cells.size() << " stored)\n";
+	std::cout << "memory            " << cellMb << " MB cells, " << overflowMb << " MB overflow\n";
+	std::cout << "fill              " << fillMs << " ms, " << fillMs * 1e6 / points << " ns per point\n";
+	std::cout << "find              " << findMs << " ms, " << findMs * 1e6 / points << " ns per query\n";
+	std::cout << "candidates/query  " << static_cast<double>(candidates) / points << "\n";
+	return 0;
+}
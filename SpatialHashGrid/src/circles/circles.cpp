@@ -70,6 +70,25 @@ ArrayOfCircles::ArrayOfCircles(const unsigned int circleCount, const float circl
 
 }
 
+void ArrayOfCircles::reorder(const std::vector<uint32_t>& order)
+{
+	const sf::VertexArray oldArray = m_circleArray;
+	const unsigned int pointsPerCircle = totalCircleVertexCount / m_circleCount;
+
+	// every circle owns one contiguous block of vertices, so only the blocks have to move
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		const size_t from = static_cast<size_t>(order[i]) * pointsPerCircle;
+		const size_t to = i * pointsPerCircle;
+
+		for (unsigned int v = 0; v < pointsPerCircle; v++)
+		{
+			m_circleArray[to + v] = oldArray[from + v];
+		}
+	}
+}
+
+
 void ArrayOfCircles::fillArrWithArr() {
 	const std::vector<sf::Vector2f> triangleVertecies = createTriangleVertecies();
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
+#include <cstdint>
 
 
 struct Circle
@@ -40,6 +41,9 @@ public:
 	explicit ArrayOfCircles(unsigned int circleCount = 0, float circleRadius = 0, unsigned int circlePoints = 0);
 	~ArrayOfCircles() = default;
 
+	// circle i takes the vertices of old circle order[i], used when the entities are re-sorted
+	void reorder(const std::vector<uint32_t>& order);
+
 private:
 	void fillArrWithArr();
 	void convertVertexArrayToCircles(const sf::VertexArray& vertexArray);
@@ -11,17 +11,19 @@ class Entity
 	sf::Color m_colorActive{};
 	sf::Color m_colorInactive{};
 
-	const float  m_radius{};
-	const float  m_radiusSquared{};
-	const float  m_maxSpeed{};
+	// not const and the border is a pointer so entities can be moved around when the array is re-sorted
+	float  m_radius{};
+	float  m_radiusSquared{};
+	float  m_maxSpeed{};
 
-	const sf::Rect<float>& m_border{};
+	const sf::Rect<float>* m_border{};
 
 public:
 	sf::Vector2f p_position{};
-	std::vector<Entity*> p_nearby{};
+	// set by the collision pass before update()
+	bool p_colliding{};
 
-	const unsigned int id{};
+	unsigned int id{};
 
 
 	// constructor and destructor
@@ -29,7 +31,7 @@ public:
 	                const sf::Color colorInactive = { 0, 0, 0 }, const float interactionRadius=1, const unsigned int _id=1, 
 	                const float maxSpeed = 1, const sf::Rect<float>& border = { 0, 0, 0, 0 })
 		: m_velocity(velocity), m_colorActive(colorActive), m_colorInactive(colorInactive), m_radius(interactionRadius),
-		m_radiusSquared(m_radius * m_radius), m_maxSpeed(maxSpeed), m_border(border), p_position(position), id(_id) {}
+		m_radiusSquared(m_radius * m_radius), m_maxSpeed(maxSpeed), m_border(&border), p_position(position), id(_id) {}
 
 	~Entity() = default;
 
@@ -51,14 +53,22 @@ public:
 		return p_position;
 	}
 
+	bool collidesWith(const Entity& other) const
+	{
+		const float dx = other.p_position.x - p_position.x;
+		const float dy = other.p_position.y - p_position.y;
+
+		return dx * dx + dy * dy <= m_radiusSquared * 2;
+	}
+
 
 private:
 	void borderCollision()
 	{
 		const float buffer = m_radius;
 
-		const bool x_out_of_bounds = p_position.x < m_border.left + buffer || p_position.x > m_border.left + m_border.width - buffer;
-		const bool y_out_of_bounds = p_position.y < m_border.top + buffer || p_position.y > m_border.top + m_border.height - buffer;
+		const bool x_out_of_bounds = p_position.x < m_border->left + buffer || p_position.x > m_border->left + m_border->width - buffer;
+		const bool y_out_of_bounds = p_position.y < m_border->top + buffer || p_position.y > m_border->top + m_border->height - buffer;
 
 		if (x_out_of_bounds) {
 			m_velocity.x *= -1;
@@ -68,8 +78,8 @@ private:
 			m_velocity.y *= -1;
 		}
 
-		p_position.x = std::max(m_border.left + buffer, std::min(p_position.x, m_border.left + m_border.width - buffer));
-		p_position.y = std::max(m_border.top + buffer, std::min(p_position.y, m_border.top + m_border.height - buffer));
+		p_position.x = std::max(m_border->left + buffer, std::min(p_position.x, m_border->left + m_border->width - buffer));
+		p_position.y = std::max(m_border->top + buffer, std::min(p_position.y, m_border->top + m_border->height - buffer));
 	}
 
 
@@ -90,25 +100,9 @@ private:
 	}
 
 
-	bool checkNearbyCollision() const
-	{
-	    for (const Entity* entity : p_nearby)
-	    {
-	        const float dx = entity->p_position.x - p_position.x;
-	        const float dy = entity->p_position.y - p_position.y;
-	        const float distSquared = dx * dx + dy * dy;
-
-	        if (distSquared <= m_radiusSquared*2 && entity->id != id)
-	            return true;
-	    }
-	    return false;
-	}
-
-
-
 	void interactWithNearby(const Circle& renderCircle, ArrayOfCircles& allCircles, const sf::Color& currentColor) const
 	{
-		if (checkNearbyCollision())
+		if (p_colliding)
 		{
 			if (currentColor != m_colorActive)
 			{
@@ -12,10 +12,14 @@
 #include <SFML/Graphics.hpp>
 
 #include <vector>
+#include <algorithm>
+#include <atomic>
 #include <ctime>
 #include <string>
 #include <sstream>
 #include "SpatialHashGrid/spatialHashGrid.h"
+#include "SpatialHashGrid/resolutionTuner.h"
+#include "SpatialHashGrid/rowBandScheduler.h"
 #include "circles/circles.hpp"
 #include "entity.hpp"
 #include "utilities/zoomableVertexArray.hpp"
@@ -64,12 +68,42 @@ std::vector<Entity> generateEntities(const float screenWidth, const float screen
 }
 
 
+// sorts the entities by the grid cell they are in so entities that are close on screen are close in memory,
+// ids are re-assigned and the circles are moved along so entity i still draws circle i
+void sortEntitiesByCell(std::vector<Entity>& entities, ArrayOfCircles& circles, const SpatialHashGrid& grid)
+{
+    std::vector<uint32_t> keys(entities.size());
+    std::vector<uint32_t> order(entities.size());
+
+    for (uint32_t i = 0; i < entities.size(); i++)
+    {
+        keys[i] = grid.cellKey(entities[i].getPosition());
+        order[i] = i;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&keys](const uint32_t a, const uint32_t b) { return keys[a] < keys[b]; });
+
+    std::vector<Entity> sorted;
+    sorted.reserve(entities.size());
+
+    for (uint32_t i = 0; i < order.size(); i++)
+    {
+        sorted.push_back(entities[order[i]]);
+        sorted.back().id = i;
+    }
+
+    entities = std::move(sorted);
+    circles.reorder(order);
+}
+
+
 struct Settings
 {
 	const unsigned int particles;
     const unsigned int vertexReserve;
     const unsigned int circleSides;
     const unsigned int deltaGridRate;
+    const unsigned int resortInterval;
 
     const float maxSpeed;
     const float entityRadius;
@@ -90,6 +124,7 @@ struct RunTimeVariables
     bool mousePressed;
     unsigned long long frameCount;
     sf::Vector2f mousePosition;
+    bool rebuildGrid;
 };
 
 
@@ -123,12 +158,14 @@ void pollEvents(sf::RenderWindow& window, RunTimeVariables& runVars, Settings& s
                 settings.CellsX += settings.deltaGridRate;
                 settings.CellsY += settings.deltaGridRate;
                 grid.reSize(settings.CellsX, settings.CellsY);
+                runVars.rebuildGrid = true;
                 break;
 
             case sf::Keyboard::Num2:
                 settings.CellsX -= settings.deltaGridRate;
                 settings.CellsY -= settings.deltaGridRate;
                 grid.reSize(settings.CellsX, settings.CellsY);
+                runVars.rebuildGrid = true;
                 break;
             }
         }
@@ -160,6 +197,7 @@ int main()
         5,
         13,
         10,
+        120,
         0.04f,
         3.5f,
         0.25f,
@@ -181,6 +219,11 @@ int main()
     ArrayOfCircles circles(settings.particles, settings.entityRadius, settings.circleSides);
     sf::Rect border{ 0.0f, 0.0f, settings.screenWidth, settings.screenHeight };
     SpatialHashGrid grid(border, settings.CellsX, settings.CellsY, settings.vertexReserve);
+    GridResolutionTuner gridTuner(settings.entityRadius * 2);
+
+    // the collision and update passes run on all cores, split into bands of grid rows
+    RowBandScheduler scheduler;
+    std::vector<SpatialHashGrid::QueryContext> queryContexts(scheduler.threads());
 
     std::vector<Entity> entities = generateEntities(
         settings.screenWidth, settings.screenHeight, settings.particles, settings.entityRadius, settings.maxSpeed, 
@@ -192,7 +235,8 @@ int main()
         false,
         false,
         0,
-        getMousePositionFloat(*window)
+        getMousePositionFloat(*window),
+        true
     );
 
     // Zooming
@@ -218,35 +262,67 @@ int main()
 
         window->clear();
 
-        if (!runVars.paused)
+        // every so often the entities are re-sorted by cell, which changes all the ids
+        if (!runVars.paused && settings.resortInterval != 0 && runVars.frameCount % settings.resortInterval == 0)
         {
-	        grid.resetGrid();
+            sortEntitiesByCell(entities, circles, grid);
+            runVars.rebuildGrid = true;
+        }
 
-	        // first loop is for adding the points
+        // the grid is only filled from scratch at the start, after a resize and after a re-sort, move() keeps it up to date otherwise
+        if (runVars.rebuildGrid)
+        {
+            grid.clear();
 	        for (int i{0}; i < entities.size(); i++)
 	        {
-	            grid.addPoint(i, entities[i].getPosition());
+	            grid.addAtom(entities[i].getPosition(), i);
 	        }
+            runVars.rebuildGrid = false;
+        }
 
+        if (!runVars.paused)
+        {
+	        // second loop is for finding the colliding entities, every pair of neighbours is only checked once.
+            // pairs cross band borders, so both flags are set atomically
+            for (Entity& entity : entities)
+            {
+                entity.p_colliding = false;
+            }
 
-	        // second loop is for querying the nearby
-	        for (Entity& entity : entities)
-	        {
-                std::vector<unsigned int> nearbyIndexes = grid.findNear(entity.p_position);
-
-                entity.p_nearby.clear();
-	        	entity.p_nearby.reserve(nearbyIndexes.size());
-
-                for (const unsigned int index : nearbyIndexes)
+            scheduler.run(grid.m_cellsXY.y, [&](const uint32_t rowBegin, const uint32_t rowEnd, const uint32_t worker)
+            {
+                grid.forEachPairInRows(rowBegin, rowEnd, queryContexts[worker], [&entities](const int32_t a, const int32_t b)
                 {
-                    entity.p_nearby.emplace_back(&entities[index]);
-                }
-	        }
+                    if (entities[a].collidesWith(entities[b]))
+                    {
+                        std::atomic_ref<bool>(entities[a].p_colliding).store(true, std::memory_order_relaxed);
+                        std::atomic_ref<bool>(entities[b].p_colliding).store(true, std::memory_order_relaxed);
+                    }
+                });
+            });
+
+            // third loop is for updating the entities with their nearby entities, by the same bands of rows. the grid
+            // isn't touched until every entity is updated
+            scheduler.run(grid.m_cellsXY.y, [&](const uint32_t rowBegin, const uint32_t rowEnd, const uint32_t)
+            {
+                grid.forEachInRows(rowBegin, rowEnd, [&](const int32_t id)
+                {
+                    entities[id].update(circles);
+                });
+            });
 
-            // third loop is for updating the entities with their nearby entities
-            for (Entity& entity : entities)
+            // the few that changed cell get re-binned, only one thread can write to the grid
+            for (const Entity& entity : entities)
+            {
+                grid.move(entity.id, entity.p_position);
+            }
+
+            // picks a better resolution every so often as the density changes
+            if (gridTuner.update(grid))
             {
-                entity.update(circles);
+                settings.CellsX = grid.m_cellsXY.x;
+                settings.CellsY = grid.m_cellsXY.y;
+                runVars.rebuildGrid = true;
             }
         }
 